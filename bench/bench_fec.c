@@ -0,0 +1,183 @@
+/*
+ * bench_fec.c
+ *
+ *  spi_fec over a simulated bit-error channel. For each bit error rate and
+ *  group size a stream of data frames is encoded, independent bit flips are
+ *  applied to every wire byte (data and parity frames), and the stream is
+ *  decoded. Reports encode/decode throughput, data frames lost with and
+ *  without FEC and goodput (payload per wire byte). Repaired frames are
+ *  compared against the originals, any mismatch fails the run.
+ *
+ *  Goodput counts every lost frame as retransmitted: a command frame, the
+ *  device's turnaround (in frame times, idle wire) and the resent frame,
+ *  repeated until both arrive intact on the same channel.
+ *
+ *  Build and run from the repository root:
+ *      gcc -std=c11 -O2 -I. bench/bench_fec.c spi_fec.c spi_protocol.c -lm -o bench_fec
+ *      ./bench_fec [frames=20000] [turnaround=0]
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <spi_protocol.h>
+#include <spi_fec.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static uint64_t now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+// xorshift, so every configuration sees a reproducible channel
+static uint32_t rng_state = 0x12345678;
+static uint32_t rng(void){
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static double rng_unit(void){
+    return ((double) rng() + 1.0) / 4294967297.0;
+}
+
+// Flips every bit independently with probability ber, skipping ahead geometrically between errors
+static uint64_t apply_channel(uint8_t* wire, size_t size, double ber){
+    if(ber <= 0.0){
+        return 0;
+    }
+    uint64_t bits = (uint64_t) size * 8;
+    uint64_t flips = 0;
+    double skip = log(1.0 - ber);
+    uint64_t bit = (uint64_t) (log(rng_unit()) / skip);
+    while(bit < bits){
+        wire[bit / 8] ^= (uint8_t) (1u << (bit % 8));
+        flips++;
+        bit += 1 + (uint64_t) (log(rng_unit()) / skip);
+    }
+    return flips;
+}
+
+// Expected wire time (in frames) to recover one lost frame: command, turnaround, resent frame,
+// retried until command and resent frame both pass their CRC
+static double retransmit_frames(double ber, double turnaround){
+    double frameOk = pow(1.0 - ber, 8.0 * SPI_PKT_SIZE);
+    return (2.0 + turnaround) / (frameOk * frameOk);
+}
+
+int main(int argc, char** argv){
+    int numFrames = argc > 1 ? atoi(argv[1]) : 20000;
+    double turnaround = argc > 2 ? atof(argv[2]) : 0.0;
+    if(numFrames < SPI_FEC_MAX_GROUP || turnaround < 0.0){
+        fprintf(stderr, "usage: %s [frames >= %d] [turnaround frame times >= 0]\n", argv[0], SPI_FEC_MAX_GROUP);
+        return 1;
+    }
+
+    static const double bers[] = {0.0, 1e-6, 1e-5, 3e-5, 1e-4, 3e-4, 1e-3};
+    static const int groups[] = {4, 8, 16};
+    const int numBers = (int) (sizeof(bers) / sizeof(bers[0]));
+    const int numGroups = (int) (sizeof(groups) / sizeof(groups[0]));
+
+    // Whole groups only, the decoder releases nothing for a trailing partial group
+    numFrames -= numFrames % SPI_FEC_MAX_GROUP;
+
+    // Smallest benchmarked group is 4, so at most one parity frame per 4 data frames
+    size_t wireCapacity = (size_t) (numFrames + numFrames / 4 + 1) * SPI_PKT_SIZE;
+    uint8_t* payloads = malloc((size_t) numFrames * SPI_PROTOCOL_PAYLOAD_SIZE);
+    uint8_t* wire = malloc(wireCapacity);
+    SpiProtocolPacket* packet = malloc(sizeof(SpiProtocolPacket));
+    SpiFecEncoder* encoder = malloc(sizeof(SpiFecEncoder));
+    SpiFecDecoder* decoder = malloc(sizeof(SpiFecDecoder));
+    if(payloads == NULL || wire == NULL || packet == NULL || encoder == NULL || decoder == NULL){
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    for(size_t i = 0; i < (size_t) numFrames * SPI_PROTOCOL_PAYLOAD_SIZE; i++){
+        payloads[i] = (uint8_t) rng();
+    }
+
+    printf("%d data frames per run, retransmission turnaround %.1f frame times\n", numFrames, turnaround);
+    printf("%8s %5s %9s %9s %9s %9s %9s %9s %9s\n", "BER", "group", "enc MB/s", "dec MB/s", "lost", "lost", "repaired", "goodput", "goodput");
+    printf("%8s %5s %9s %9s %9s %9s %9s %9s %9s\n", "", "", "", "", "no FEC", "FEC", "", "no FEC", "FEC");
+
+    int failed = 0;
+    for(int b = 0; b < numBers; b++){
+        for(int g = 0; g < numGroups; g++){
+            int groupSize = groups[g];
+
+            // Encode straight into the wire buffer, parity frame after every group
+            uint64_t start = now_ns();
+            spi_fec_encoder_init(encoder, groupSize);
+            size_t wireSize = 0;
+            for(int i = 0; i < numFrames; i++){
+                spi_protocol_write_packet(packet, payloads + (size_t) i * SPI_PROTOCOL_PAYLOAD_SIZE, SPI_PROTOCOL_PAYLOAD_SIZE);
+                memcpy(wire + wireSize, SPI_PROTOCOL_FRAME(packet), SPI_PKT_SIZE);
+                wireSize += SPI_PKT_SIZE;
+                if(spi_fec_encode(encoder, packet)){
+                    spi_fec_write_parity(encoder, packet);
+                    memcpy(wire + wireSize, SPI_PROTOCOL_FRAME(packet), SPI_PKT_SIZE);
+                    wireSize += SPI_PKT_SIZE;
+                }
+            }
+            double encodeNs = (double) (now_ns() - start);
+
+            apply_channel(wire, wireSize, bers[b]);
+
+            // Without FEC every data frame failing its CRC is lost
+            int lostPlain = 0;
+            for(size_t offset = 0, index = 0; offset < wireSize; offset += SPI_PKT_SIZE, index++){
+                int isParity = (int) (index % (size_t) (groupSize + 1)) == groupSize;
+                if(!isParity && !spi_protocol_check_frame(wire + offset)){
+                    lostPlain++;
+                }
+            }
+
+            start = now_ns();
+            spi_fec_decoder_init(decoder, groupSize);
+            int lostFec = 0;
+            int wrong = 0;
+            int dataIndex = 0;
+            for(size_t offset = 0; offset < wireSize; offset += SPI_PKT_SIZE){
+                int released = spi_fec_decode(decoder, wire + offset);
+                for(int i = 0; i < released; i++, dataIndex++){
+                    const SpiProtocolPacket* decoded = spi_fec_decoder_packet(decoder, i);
+                    if(decoded == NULL){
+                        lostFec++;
+                    } else if(memcmp(decoded->data, payloads + (size_t) dataIndex * SPI_PROTOCOL_PAYLOAD_SIZE, SPI_PROTOCOL_PAYLOAD_SIZE) != 0){
+                        wrong++;
+                    }
+                }
+            }
+            double decodeNs = (double) (now_ns() - start);
+
+            if(wrong > 0 || dataIndex != numFrames){
+                failed = 1;
+            }
+
+            // Every frame is delivered in the end, losses cost wire time for their retransmissions
+            double payloadMb = (double) numFrames * SPI_PROTOCOL_PAYLOAD_SIZE / (1 << 20);
+            double payloadBytes = (double) numFrames * SPI_PROTOCOL_PAYLOAD_SIZE;
+            double retransmitBytes = retransmit_frames(bers[b], turnaround) * SPI_PKT_SIZE;
+            double goodputPlain = payloadBytes / ((double) numFrames * SPI_PKT_SIZE + lostPlain * retransmitBytes);
+            double goodputFec = payloadBytes / ((double) wireSize + lostFec * retransmitBytes);
+            printf("%8.0e %5d %9.1f %9.1f %9d %9d %9u %8.2f%% %8.2f%%%s\n",
+                bers[b], groupSize, payloadMb / (encodeNs / 1e9), payloadMb / (decodeNs / 1e9),
+                lostPlain, lostFec, decoder->repaired, goodputPlain * 100.0, goodputFec * 100.0,
+                wrong > 0 ? "  WRONG PAYLOADS" : "");
+        }
+    }
+
+    free(payloads);
+    free(wire);
+    free(packet);
+    free(encoder);
+    free(decoder);
+    return failed;
+}
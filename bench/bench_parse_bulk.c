@@ -0,0 +1,145 @@
+/*
+ * bench_parse_bulk.c
+ *
+ *  Throughput of spi_protocol_parse_bulk() per thread count against
+ *  sequential spi_protocol_parse(), on a generated multi-MB stream of valid
+ *  frames, corrupted frames and junk between them. Bulk output is checked
+ *  against the sequential parser on every run.
+ *
+ *  Build and run from the repository root:
+ *      gcc -std=c11 -O2 -I. bench/bench_parse_bulk.c spi_protocol.c spi_protocol_bulk.c -lpthread -o bench_parse_bulk
+ *      ./bench_parse_bulk [size_mb=64] [max_threads=8] [repeats=5]
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <spi_protocol.h>
+#include <spi_protocol_bulk.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static uint64_t now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+// xorshift, so the stream is the same on every run
+static uint32_t rng_state = 0x12345678;
+static uint32_t rng(void){
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+// Frames back to back with occasional junk in between, 1 in 64 frames has a bad CRC
+static size_t generate(uint8_t* buffer, size_t size){
+    SpiProtocolPacket packet;
+    uint8_t payload[SPI_PROTOCOL_PAYLOAD_SIZE];
+    size_t used = 0;
+    while(used + 64 + SPI_PKT_SIZE <= size){
+        if((rng() & 7) == 0){
+            int junk = (int) (rng() % 64);
+            for(int i = 0; i < junk; i++){
+                buffer[used++] = (uint8_t) rng();
+            }
+        }
+        for(int i = 0; i < SPI_PROTOCOL_PAYLOAD_SIZE; i++){
+            payload[i] = (uint8_t) rng();
+        }
+        spi_protocol_write_packet(&packet, payload, SPI_PROTOCOL_PAYLOAD_SIZE);
+        memcpy(buffer + used, SPI_PROTOCOL_FRAME(&packet), SPI_PKT_SIZE);
+        if((rng() & 63) == 0){
+            buffer[used + 1 + rng() % SPI_PROTOCOL_PAYLOAD_SIZE] ^= 0x10;
+        }
+        used += SPI_PKT_SIZE;
+    }
+    return used;
+}
+
+static int parse_sequential(const uint8_t* buffer, size_t size, SpiProtocolPacket* packets, int max_packets){
+    SpiProtocolInstance instance;
+    spi_protocol_init(&instance);
+    int count = 0;
+    for(size_t offset = 0; offset < size && count < max_packets; offset += SPI_PKT_SIZE){
+        int chunk = size - offset < SPI_PKT_SIZE ? (int) (size - offset) : SPI_PKT_SIZE;
+        SpiProtocolPacket* packet = spi_protocol_parse(&instance, buffer + offset, chunk);
+        if(packet != NULL){
+            memcpy(&packets[count++], packet, sizeof(*packet));
+        }
+    }
+    return count;
+}
+
+static int same_packets(const SpiProtocolPacket* a, const SpiProtocolPacket* b, int count){
+    for(int i = 0; i < count; i++){
+        if(memcmp(SPI_PROTOCOL_FRAME(&a[i]), SPI_PROTOCOL_FRAME(&b[i]), SPI_PKT_SIZE) != 0){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int main(int argc, char** argv){
+    size_t sizeMb = argc > 1 ? (size_t) atoi(argv[1]) : 64;
+    int maxThreads = argc > 2 ? atoi(argv[2]) : 8;
+    int repeats = argc > 3 ? atoi(argv[3]) : 5;
+    if(sizeMb == 0 || maxThreads < 1 || maxThreads > SPI_PROTOCOL_BULK_MAX_THREADS || repeats < 1){
+        fprintf(stderr, "usage: %s [size_mb] [max_threads <= %d] [repeats]\n", argv[0], SPI_PROTOCOL_BULK_MAX_THREADS);
+        return 1;
+    }
+
+    size_t capacity = sizeMb << 20;
+    int maxPackets = (int) (capacity / SPI_PKT_SIZE);
+    uint8_t* buffer = malloc(capacity);
+    SpiProtocolPacket* expected = malloc(sizeof(SpiProtocolPacket) * maxPackets);
+    SpiProtocolPacket* packets = malloc(sizeof(SpiProtocolPacket) * maxPackets);
+    if(buffer == NULL || expected == NULL || packets == NULL){
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    size_t size = generate(buffer, capacity);
+    double mb = (double) size / (1 << 20);
+
+    // Best of repeats, the first pass also warms up the pages
+    int expectedCount = 0;
+    uint64_t best = UINT64_MAX;
+    for(int r = 0; r < repeats; r++){
+        uint64_t start = now_ns();
+        expectedCount = parse_sequential(buffer, size, expected, maxPackets);
+        uint64_t elapsed = now_ns() - start;
+        best = elapsed < best ? elapsed : best;
+    }
+    double sequential = mb / ((double) best / 1e9);
+    printf("input %.1f MB, %d valid frames\n", mb, expectedCount);
+    printf("%-12s %10s %10s %8s\n", "parser", "MB/s", "speedup", "match");
+    printf("%-12s %10.1f %10.2f %8s\n", "sequential", sequential, 1.0, "-");
+
+    int failed = 0;
+    for(int threads = 1; threads <= maxThreads; threads *= 2){
+        int count = 0;
+        best = UINT64_MAX;
+        for(int r = 0; r < repeats; r++){
+            uint64_t start = now_ns();
+            count = spi_protocol_parse_bulk(buffer, size, packets, maxPackets, threads, NULL);
+            uint64_t elapsed = now_ns() - start;
+            best = elapsed < best ? elapsed : best;
+        }
+        int match = count == expectedCount && same_packets(expected, packets, count);
+        failed |= !match;
+        double throughput = mb / ((double) best / 1e9);
+        char name[32];
+        snprintf(name, sizeof(name), "bulk x%d", threads);
+        printf("%-12s %10.1f %10.2f %8s\n", name, throughput, throughput / sequential, match ? "yes" : "NO");
+    }
+
+    free(buffer);
+    free(expected);
+    free(packets);
+    return failed;
+}
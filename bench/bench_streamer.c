@@ -0,0 +1,107 @@
+/*
+ * bench_streamer.c
+ *
+ *  Device side response streaming throughput: a message is streamed into
+ *  frames one at a time with spi_streamer_next() (one TX buffer per
+ *  transfer) and a descriptor ring at a time with spi_streamer_fill().
+ *  Reports message MB/s and ns per frame. Every streamed frame is parsed
+ *  back with spi_protocol_parse() once before timing, any mismatch fails
+ *  the run.
+ *
+ *  Build and run from the repository root:
+ *      gcc -std=c11 -O2 -I. bench/bench_streamer.c spi_device.c spi_messaging.c spi_protocol.c -lm -o bench_streamer
+ *      ./bench_streamer [message_size=4000000] [ring=16]
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <spi_device.h>
+#include <spi_protocol.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define ROUNDS 20
+
+static uint64_t now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+// Streams the message and parses every frame back, returns 0 if it is received intact
+static int verify(const uint8_t* message, uint32_t size, SpiProtocolPacket* ring, int ring_size){
+    SpiResponseStreamer streamer;
+    SpiProtocolInstance instance;
+    spi_streamer_init(&streamer, message, size);
+    spi_protocol_init(&instance);
+
+    uint32_t received = 0;
+    int frames;
+    while((frames = spi_streamer_fill(&streamer, ring, ring_size)) > 0){
+        for(int i = 0; i < frames; i++){
+            SpiProtocolPacket* packet = spi_protocol_parse(&instance, SPI_PROTOCOL_FRAME(&ring[i]), SPI_PKT_SIZE);
+            uint32_t chunk = size - received < SPI_PROTOCOL_PAYLOAD_SIZE ? size - received : SPI_PROTOCOL_PAYLOAD_SIZE;
+            if(packet == NULL || memcmp(packet->data, message + received, chunk) != 0){
+                return -1;
+            }
+            received += chunk;
+        }
+    }
+    return received == size ? 0 : -1;
+}
+
+static void report(const char* name, uint32_t size, uint64_t elapsed){
+    double bytes = (double) size * ROUNDS;
+    double frames = (double) ((size + SPI_PROTOCOL_PAYLOAD_SIZE - 1) / SPI_PROTOCOL_PAYLOAD_SIZE) * ROUNDS;
+    printf("%-24s %8.1f MB/s %8.1f ns/frame\n", name, bytes / (1 << 20) / ((double) elapsed / 1e9), (double) elapsed / frames);
+}
+
+int main(int argc, char** argv){
+    uint32_t size = argc > 1 ? (uint32_t) strtoul(argv[1], NULL, 10) : 4000000;
+    int ring_size = argc > 2 ? atoi(argv[2]) : 16;
+    if(ring_size < 1){
+        ring_size = 1;
+    }
+
+    uint8_t* message = malloc(size);
+    SpiProtocolPacket* ring = malloc(sizeof(SpiProtocolPacket) * (size_t) ring_size);
+    if(message == NULL || ring == NULL){
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    for(uint32_t i = 0; i < size; i++){
+        message[i] = (uint8_t) (i * 31 + (i >> 8));
+    }
+
+    if(verify(message, size, ring, ring_size) != 0){
+        printf("streamed frames don't match the message: FAILED\n");
+        return 1;
+    }
+
+    printf("message %u B, %d frame ring, %u frames per round\n", size, ring_size, (size + SPI_PROTOCOL_PAYLOAD_SIZE - 1) / SPI_PROTOCOL_PAYLOAD_SIZE);
+
+    SpiResponseStreamer streamer;
+    uint64_t start = now_ns();
+    for(int round = 0; round < ROUNDS; round++){
+        spi_streamer_init(&streamer, message, size);
+        while(spi_streamer_next(&streamer, &ring[0]) > 0){
+        }
+    }
+    report("spi_streamer_next", size, now_ns() - start);
+
+    start = now_ns();
+    for(int round = 0; round < ROUNDS; round++){
+        spi_streamer_init(&streamer, message, size);
+        while(spi_streamer_fill(&streamer, ring, ring_size) > 0){
+        }
+    }
+    report("spi_streamer_fill", size, now_ns() - start);
+
+    free(ring);
+    free(message);
+    return 0;
+}
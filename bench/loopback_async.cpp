@@ -0,0 +1,236 @@
+/*
+ * loopback_async.cpp
+ *
+ *  spi_async.hpp against the device side engine (spi_dispatch and the
+ *  response streamer) over an in-process loopback transport. Every transfer
+ *  is full-duplex: the device clocks out its next response frame while the
+ *  host's frame is parsed and dispatched. The device needs a few transfers
+ *  to prepare each response, like the real firmware.
+ *
+ *  Runs GET_MESSAGE, GET_METADATA, POP_MESSAGE, an oversized stream name and
+ *  a device that never answers (poll timeout), with a transport completing
+ *  synchronously and one resuming the coroutine from a queue. Checks every
+ *  result, then reports GET_MESSAGE throughput. Exits with 1 on any failure.
+ *
+ *  Build and run from the repository root:
+ *      gcc -std=c11 -O2 -I. -c spi_protocol.c spi_messaging.c spi_device.c
+ *      g++ -std=c++20 -O2 -I. bench/loopback_async.cpp spi_protocol.o spi_messaging.o spi_device.o -lm -o loopback_async
+ *      ./loopback_async [message_size=1000000] [iterations=50]
+ *
+ */
+
+#include <spi_async.hpp>
+#include <spi_device.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <vector>
+
+namespace {
+
+constexpr uint32_t METADATA_TYPE = 7;
+constexpr uint32_t METADATA_SIZE = 10;
+
+// Device side: one queued message and its metadata, served for any stream name
+struct SimDevice {
+    spi::Parser parser;
+    SpiDispatcher dispatcher;
+    SpiResponseStreamer streamer;
+    SpiProtocolPacket out;
+    std::vector<uint8_t> message;
+    std::vector<uint8_t> metadata;
+    uint8_t response[4];
+    // Transfers until a response is ready
+    int delay = 3;
+    int pending = 0;
+    int pops = 0;
+};
+
+int handle_size(const SpiCmdMessage* command, void* user){
+    SimDevice* device = static_cast<SimDevice*>(user);
+    uint32_t size = (uint32_t) (command->cmd == GET_METASIZE ? device->metadata.size() : device->message.size());
+    std::memcpy(device->response, &size, sizeof(size));
+    spi_streamer_init(&device->streamer, device->response, sizeof(size));
+    device->pending = device->delay;
+    return 0;
+}
+
+int handle_get(const SpiCmdMessage* command, void* user){
+    SimDevice* device = static_cast<SimDevice*>(user);
+    const std::vector<uint8_t>& data = command->cmd == GET_METADATA ? device->metadata : device->message;
+    spi_streamer_init(&device->streamer, data.data(), (uint32_t) data.size());
+    device->pending = device->delay;
+    return 0;
+}
+
+int handle_pop(const SpiCmdMessage*, void* user){
+    SimDevice* device = static_cast<SimDevice*>(user);
+    device->response[0] = (uint8_t) SPI_MSG_SUCCESS_RESP;
+    spi_streamer_init(&device->streamer, device->response, 1);
+    device->pops++;
+    return 0;
+}
+
+const SpiCommandEntry HANDLERS[] = {
+    {GET_SIZE, handle_size},
+    {GET_METASIZE, handle_size},
+    {GET_MESSAGE, handle_get},
+    {GET_METADATA, handle_get},
+    {POP_MESSAGE, handle_pop},
+};
+
+struct Loopback {
+    // async false: complete in submit(), true: resume from run()
+    Loopback(SimDevice& device, bool async) : device(device), async(async) {}
+
+    SimDevice& device;
+    bool async;
+    std::deque<std::coroutine_handle<>> queue;
+    uint64_t transfers = 0;
+
+    bool submit(spi::WireView tx, spi::RxView rx, std::coroutine_handle<> continuation){
+        transfers++;
+        if(device.pending > 0){
+            device.pending--;
+            std::memset(rx.data(), 0, rx.size());
+        } else if(spi_streamer_next(&device.streamer, &device.out) > 0){
+            std::memcpy(rx.data(), SPI_PROTOCOL_FRAME(&device.out), SPI_PKT_SIZE);
+        } else {
+            std::memset(rx.data(), 0, rx.size());
+        }
+        device.parser.parse(std::span<const uint8_t>(tx), [&](spi::PayloadView){
+            spi::Packet command = device.parser.take();
+            spi_dispatch(&device.dispatcher, command.get());
+        });
+
+        if(!async){
+            return true;
+        }
+        queue.push_back(continuation);
+        return false;
+    }
+
+    void run(){
+        while(!queue.empty()){
+            std::coroutine_handle<> handle = queue.front();
+            queue.pop_front();
+            handle.resume();
+        }
+    }
+};
+static_assert(spi::Transport<Loopback>);
+
+void setup(SimDevice& device, const SpiCommandEntry* handlers, int numHandlers, uint32_t messageSize){
+    spi_dispatcher_init(&device.dispatcher, handlers, numHandlers, &device);
+    spi_streamer_init(&device.streamer, nullptr, 0);
+    device.message.resize(messageSize);
+    for(uint32_t i = 0; i < messageSize; i++){
+        device.message[i] = (uint8_t) (i * 7);
+    }
+    // Metadata payload followed by its type and size trailer
+    device.metadata.assign(METADATA_SIZE, 0x5a);
+    uint32_t trailer[2] = {METADATA_TYPE, METADATA_SIZE};
+    device.metadata.insert(device.metadata.end(), (const uint8_t*) trailer, (const uint8_t*) (trailer + 2));
+}
+
+spi::Task<int> check_commands(spi::Device<Loopback>& host, const SimDevice& device){
+    int failures = 0;
+
+    std::optional<spi::Message> message = co_await host.get_message("color");
+    if(!message || message->data().size() != device.message.size() || std::memcmp(message->data().data(), device.message.data(), device.message.size()) != 0){
+        std::printf("  GET_MESSAGE: wrong data\n");
+        failures++;
+    }
+
+    std::optional<spi::Message> metadata = co_await host.get_metadata("color");
+    if(!metadata || metadata->type() != METADATA_TYPE || metadata->data().size() != METADATA_SIZE){
+        std::printf("  GET_METADATA: wrong type or size\n");
+        failures++;
+    }
+
+    if(!co_await host.pop_message("color")){
+        std::printf("  POP_MESSAGE: not acknowledged\n");
+        failures++;
+    }
+
+    if(co_await host.get_message("stream_name_longer_than_16")){
+        std::printf("  oversized stream name accepted\n");
+        failures++;
+    }
+
+    co_return failures;
+}
+
+spi::Task<int> fetch(spi::Device<Loopback>& host, int iterations, uint32_t size){
+    int failures = 0;
+    for(int i = 0; i < iterations; i++){
+        std::optional<spi::Message> message = co_await host.get_message("color");
+        if(!message || message->data().size() != size){
+            failures++;
+        }
+    }
+    co_return failures;
+}
+
+} // namespace
+
+int main(int argc, char** argv){
+    uint32_t messageSize = argc > 1 ? (uint32_t) std::strtoul(argv[1], nullptr, 10) : 1000000;
+    int iterations = argc > 2 ? std::atoi(argv[2]) : 50;
+    const int numHandlers = (int) (sizeof(HANDLERS) / sizeof(HANDLERS[0]));
+    int failures = 0;
+
+    for(int async = 0; async < 2; async++){
+        const char* mode = async ? "async" : "sync";
+        SimDevice device;
+        setup(device, HANDLERS, numHandlers, messageSize);
+        Loopback transport(device, async != 0);
+        spi::Device<Loopback> host(transport);
+
+        spi::Task<int> commands = check_commands(host, device);
+        commands.start();
+        transport.run();
+        if(!commands.done() || commands.result() != 0 || device.pops != 1){
+            std::printf("%-5s commands: FAILED\n", mode);
+            failures++;
+            continue;
+        }
+
+        transport.transfers = 0;
+        auto start = std::chrono::steady_clock::now();
+        spi::Task<int> loop = fetch(host, iterations, messageSize);
+        loop.start();
+        transport.run();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if(!loop.done() || loop.result() != 0){
+            std::printf("%-5s GET_MESSAGE loop: FAILED\n", mode);
+            failures++;
+            continue;
+        }
+
+        double bytes = (double) messageSize * iterations;
+        std::printf("%-5s commands OK, %d x GET_MESSAGE of %u B: %llu transfers, %.1f MB/s, %.2f us/transfer\n",
+            mode, iterations, messageSize, (unsigned long long) transport.transfers,
+            bytes / (1 << 20) / seconds, seconds * 1e6 / (double) transport.transfers);
+    }
+
+    // A device without handlers never answers, the command fails after maxPolls idle transfers
+    {
+        const int maxPolls = 8;
+        SimDevice device;
+        setup(device, nullptr, 0, 0);
+        Loopback transport(device, true);
+        spi::Device<Loopback> host(transport, maxPolls);
+        spi::Task<std::optional<uint32_t>> size = host.get_size("color");
+        size.start();
+        transport.run();
+        bool ok = size.done() && !size.result().has_value() && transport.transfers == 1 + maxPolls;
+        std::printf("timeout after %llu transfers: %s\n", (unsigned long long) transport.transfers, ok ? "OK" : "FAILED");
+        failures += ok ? 0 : 1;
+    }
+
+    return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,148 @@
+/*
+ * spi_replay.c
+ *
+ *  Replays a capture (spi_capture.h) through spi_protocol and, with -c,
+ *  through the messaging layer: every parsed packet is dispatched as a host
+ *  command (spi_dispatch) and counted per command and stream, as a device
+ *  would see it. Reports replay throughput and frame boundary checks, and
+ *  exits with 2 if any boundary differs from the capture, so captures of
+ *  real incidents can be used as regression tests.
+ *
+ *  Build and run from the repository root:
+ *      gcc -std=c11 -O2 -I. bench/spi_replay.c spi_capture.c spi_protocol.c spi_messaging.c spi_device.c -lm -o spi_replay
+ *      ./spi_replay [-r] [-c] capture.bin
+ *          -r  keep recorded inter-transfer timing (default: as fast as possible)
+ *          -c  decode packets as host commands
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <spi_capture.h>
+#include <spi_device.h>
+#include <spi_messaging.h>
+#include <spi_protocol.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_COMMANDS 32
+#define MAX_NAMES 32
+
+typedef struct {
+    SpiDispatcher dispatcher;
+    uint32_t commands[MAX_COMMANDS];
+    char names[MAX_NAMES][MAX_STREAMNAME + 1];
+    uint32_t nameCounts[MAX_NAMES];
+    int numNames;
+    uint32_t invalid;
+} CommandStats;
+
+static const char* COMMAND_NAMES[] = {
+    "GET_SIZE", "GET_METASIZE", "GET_MESSAGE", "GET_METADATA", "GET_MESSAGE_PART",
+    "POP_MESSAGES", "POP_MESSAGE", "GET_STREAMS", "SEND_DATA", "GET_MESSAGE_FAST",
+    "GET_READY_STREAMS", "GET_METADATA_DELTA", "GET_SEND_CREDITS"
+};
+#define NUM_COMMAND_NAMES ((int) (sizeof(COMMAND_NAMES) / sizeof(COMMAND_NAMES[0])))
+
+static uint64_t now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+static int count_command(const SpiCmdMessage* message, void* user){
+    CommandStats* stats = (CommandStats*) user;
+    stats->commands[message->cmd]++;
+
+    char name[MAX_STREAMNAME + 1];
+    memcpy(name, message->stream_name, message->stream_name_len);
+    name[message->stream_name_len] = '\0';
+    for(int i = 0; i < stats->numNames; i++){
+        if(strcmp(stats->names[i], name) == 0){
+            stats->nameCounts[i]++;
+            return 0;
+        }
+    }
+    if(stats->numNames < MAX_NAMES){
+        strcpy(stats->names[stats->numNames], name);
+        stats->nameCounts[stats->numNames++] = 1;
+    }
+    return 0;
+}
+
+static void on_packet(const SpiProtocolPacket* packet, uint64_t timestamp_ns, void* user){
+    (void) timestamp_ns;
+    CommandStats* stats = (CommandStats*) user;
+    int ret = spi_dispatch(&stats->dispatcher, packet);
+    if(ret == SPI_DEVICE_NO_HANDLER || ret == SPI_DEVICE_INVALID_COMMAND){
+        stats->invalid++;
+    }
+}
+
+int main(int argc, char** argv){
+    int realtime = 0;
+    int decode = 0;
+    int opt;
+    while((opt = getopt(argc, argv, "rc")) != -1){
+        switch(opt){
+            case 'r': realtime = 1; break;
+            case 'c': decode = 1; break;
+            default:
+                fprintf(stderr, "usage: %s [-r] [-c] capture.bin\n", argv[0]);
+                return 1;
+        }
+    }
+    if(optind >= argc){
+        fprintf(stderr, "usage: %s [-r] [-c] capture.bin\n", argv[0]);
+        return 1;
+    }
+
+    // One handler counts every command, unknown command bytes fall through as invalid
+    static SpiCommandEntry table[MAX_COMMANDS];
+    static CommandStats commandStats;
+    for(int i = 0; i < MAX_COMMANDS; i++){
+        table[i].cmd = (spi_command) i;
+        table[i].handler = count_command;
+    }
+    spi_dispatcher_init(&commandStats.dispatcher, table, NUM_COMMAND_NAMES, &commandStats);
+
+    SpiProtocolInstance instance;
+    spi_protocol_init(&instance);
+    SpiCaptureReplayStats stats;
+
+    uint64_t start = now_ns();
+    int ret = spi_capture_replay(argv[optind], &instance, realtime, decode ? on_packet : NULL, &commandStats, &stats);
+    double seconds = (double) (now_ns() - start) / 1e9;
+    if(ret != SPI_CAPTURE_OK){
+        fprintf(stderr, "replay of %s failed: %d\n", argv[optind], ret);
+        return 1;
+    }
+
+    printf("transfers           %u\n", stats.transfers);
+    printf("bytes               %llu\n", (unsigned long long) stats.bytes);
+    printf("frames              %u (capture: %u)\n", stats.frames, stats.framesExpected);
+    printf("boundary mismatches %u", stats.boundaryMismatches);
+    if(stats.boundaryMismatches > 0){
+        printf(" (first at byte %llu)", (unsigned long long) stats.firstMismatchOffset);
+    }
+    printf("\nreplay              %.3f s, %.1f MB/s\n", seconds, seconds > 0 ? (double) stats.bytes / (1 << 20) / seconds : 0.0);
+
+    if(decode){
+        printf("\ncommands\n");
+        for(int i = 0; i < NUM_COMMAND_NAMES; i++){
+            if(commandStats.commands[i] > 0){
+                printf("  %-20s %u\n", COMMAND_NAMES[i], commandStats.commands[i]);
+            }
+        }
+        printf("  %-20s %u\n", "(not a command)", commandStats.invalid);
+        printf("streams\n");
+        for(int i = 0; i < commandStats.numNames; i++){
+            printf("  %-20s %u\n", commandStats.names[i][0] ? commandStats.names[i] : "(none)", commandStats.nameCounts[i]);
+        }
+    }
+
+    return stats.boundaryMismatches > 0 ? 2 : 0;
+}
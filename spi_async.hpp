@@ -0,0 +1,274 @@
+/*
+ * spi_async.hpp
+ *
+ *  C++20 coroutine API for host side commands, built on spi_messaging.hpp.
+ *
+ *  Every SPI transfer is submitted to a user provided transport and the
+ *  calling coroutine is resumed once the transport completes it, so commands
+ *  read like blocking code without blocking a thread:
+ *
+ *      spi::Task<void> run(spi::Device<MyTransport>& dev){
+ *          std::optional<spi::Message> frame = co_await dev.get_message("color");
+ *          ...
+ *      }
+ *
+ *  A Device owns its transfer buffers and its Parser, responses are
+ *  reassembled straight from the parser's payload views into the returned
+ *  Message. One command runs on a Device at a time, use one Device per
+ *  transport queue to overlap commands.
+ *
+ */
+
+#ifndef SHARED_SPI_ASYNC_HPP
+#define SHARED_SPI_ASYNC_HPP
+
+#include <spi_messaging.hpp>
+
+#include <array>
+#include <concepts>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <string>
+#include <utility>
+
+namespace spi {
+
+using RxView = std::span<uint8_t, SPI_PKT_SIZE>;
+
+/**
+ * Transport for a Device. submit() starts one full-duplex transfer of SPI_PKT_SIZE bytes.
+ * tx and rx stay valid until the transfer completes.
+ *
+ * Returns true if the transfer already completed (continuation must not be resumed),
+ * false if the transport will call continuation.resume() once it completes.
+ */
+template <typename T>
+concept Transport = requires(T& transport, WireView tx, RxView rx, std::coroutine_handle<> continuation) {
+    { transport.submit(tx, rx, continuation) } -> std::convertible_to<bool>;
+};
+
+
+/**
+ * Lazily started coroutine returning T. Awaitable from other coroutines,
+ * top level tasks are started with start() and polled with done().
+ */
+template <typename T>
+class Task {
+public:
+    struct promise_type;
+    using Handle = std::coroutine_handle<promise_type>;
+
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+        std::coroutine_handle<> await_suspend(Handle handle) noexcept {
+            std::coroutine_handle<> continuation = handle.promise().continuation;
+            return continuation ? continuation : std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+    };
+
+    struct PromiseBase {
+        std::coroutine_handle<> continuation;
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        FinalAwaiter final_suspend() noexcept { return {}; }
+        // Errors are reported through return values, like the C API
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    struct ValuePromise : PromiseBase {
+        std::optional<T> value;
+        void return_value(T result) { value = std::move(result); }
+    };
+
+    struct VoidPromise : PromiseBase {
+        void return_void() {}
+    };
+
+    struct promise_type : std::conditional_t<std::is_void_v<T>, VoidPromise, ValuePromise> {
+        Task get_return_object() { return Task(Handle::from_promise(*this)); }
+    };
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    Task(Task&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+    Task& operator=(Task&& other) noexcept {
+        if(this != &other){
+            destroy();
+            handle_ = std::exchange(other.handle_, nullptr);
+        }
+        return *this;
+    }
+    ~Task(){ destroy(); }
+
+    // Top level use
+    void start(){ handle_.resume(); }
+    bool done() const { return handle_.done(); }
+    template <typename U = T>
+    requires (!std::is_void_v<U>)
+    U& result(){ return *handle_.promise().value; }
+
+    // Awaiting from another coroutine starts the task and resumes the awaiter when it finishes
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) noexcept {
+        handle_.promise().continuation = continuation;
+        return handle_;
+    }
+    T await_resume(){
+        if constexpr(!std::is_void_v<T>){
+            return std::move(*handle_.promise().value);
+        }
+    }
+
+private:
+    explicit Task(Handle handle) : handle_(handle) {}
+    void destroy(){
+        if(handle_){
+            handle_.destroy();
+            handle_ = nullptr;
+        }
+    }
+
+    Handle handle_;
+};
+
+
+/**
+ * Host side of the messaging protocol over a Transport
+ */
+template <Transport T>
+class Device {
+public:
+    /**
+     * @param transport Transport, must outlive the Device
+     * @param maxPolls Number of idle transfers without a response packet before a command fails
+     */
+    explicit Device(T& transport, int maxPolls = 1024) : transport_(transport), maxPolls_(maxPolls) {
+        idle_ = Packet::allocate();
+        command_ = Packet::allocate();
+        // Idle frames carry no start byte, the device ignores them
+        std::memset(SPI_PROTOCOL_FRAME(idle_.get()), 0, SPI_PKT_SIZE);
+    }
+    Device(const Device&) = delete;
+    Device& operator=(const Device&) = delete;
+
+    // GET_SIZE / GET_METASIZE
+    Task<std::optional<uint32_t>> get_size(std::string stream, spi_command cmd = GET_SIZE){
+        if(!co_await send(cmd, stream)){
+            co_return std::nullopt;
+        }
+        Message resp(sizeof(uint32_t), traceTag_);
+        if(!co_await receive(resp, sizeof(uint32_t))){
+            co_return std::nullopt;
+        }
+        SpiGetSizeResp size;
+        spi_parse_get_size_resp(&size, resp.raw().data());
+        co_return size.size;
+    }
+
+    // GET_SIZE followed by GET_MESSAGE, nullopt on failure
+    Task<std::optional<Message>> get_message(std::string stream){
+        return get(std::move(stream), GET_SIZE, GET_MESSAGE);
+    }
+
+    // GET_METASIZE followed by GET_METADATA, nullopt on failure
+    Task<std::optional<Message>> get_metadata(std::string stream){
+        return get(std::move(stream), GET_METASIZE, GET_METADATA);
+    }
+
+    // POP_MESSAGE, true if the device acknowledged
+    Task<bool> pop_message(std::string stream){
+        if(!co_await send(POP_MESSAGE, stream)){
+            co_return false;
+        }
+        Message resp(1, traceTag_);
+        if(!co_await receive(resp, 1)){
+            co_return false;
+        }
+        SpiStatusResp status;
+        spi_status_resp(&status, resp.raw().data());
+        co_return status.status == SPI_MSG_SUCCESS_RESP;
+    }
+
+private:
+    struct TransferAwaiter {
+        T& transport;
+        WireView tx;
+        RxView rx;
+        bool await_ready() const noexcept { return false; }
+        // Suspend only if the transport completes asynchronously
+        bool await_suspend(std::coroutine_handle<> continuation){ return !transport.submit(tx, rx, continuation); }
+        void await_resume() const noexcept {}
+    };
+
+    TransferAwaiter transfer(WireView tx){
+        return TransferAwaiter{transport_, tx, RxView(rx_)};
+    }
+
+    Task<std::optional<Message>> get(std::string stream, spi_command sizeCmd, spi_command getCmd){
+        std::optional<uint32_t> size = co_await get_size(stream, sizeCmd);
+        if(!size){
+            co_return std::nullopt;
+        }
+        if(!co_await send(getCmd, stream)){
+            co_return std::nullopt;
+        }
+        Message message(*size, traceTag_);
+        if(!co_await receive(message, *size)){
+            co_return std::nullopt;
+        }
+        if(!message.finalize(getCmd)){
+            co_return std::nullopt;
+        }
+        co_return std::optional<Message>(std::move(message));
+    }
+
+    Task<bool> send(spi_command cmd, const std::string& stream){
+        if(stream.size() > MAX_STREAMNAME){
+            co_return false;
+        }
+        command(command_.get(), cmd, stream);
+        // Response of this command is parsed next, attribute its phases to it
+        traceTag_ = trace_tag(cmd, stream);
+        parser_.set_trace_tag(traceTag_);
+        uint64_t start = spi_messaging_trace_now();
+        co_await transfer(command_.wire());
+        spi_messaging_trace_phase(traceTag_, SPI_TRACE_TRANSFER, start);
+        co_return true;
+    }
+
+    // Clocks out idle frames until size bytes of response payload were received
+    Task<bool> receive(Message& message, uint32_t size){
+        uint32_t received = 0;
+        int polls = 0;
+        uint64_t start = spi_messaging_trace_now();
+        while(received < size){
+            if(polls++ >= maxPolls_){
+                co_return false;
+            }
+            co_await transfer(idle_.wire());
+            int packets = parser_.parse(std::span<const uint8_t>(rx_), [&](PayloadView payload){
+                uint32_t chunk = size - received < SPI_PROTOCOL_PAYLOAD_SIZE ? size - received : SPI_PROTOCOL_PAYLOAD_SIZE;
+                message.append(payload, chunk);
+                received += chunk;
+            });
+            if(packets > 0){
+                polls = 0;
+            }
+        }
+        spi_messaging_trace_phase(traceTag_, SPI_TRACE_TRANSFER, start);
+        co_return true;
+    }
+
+    T& transport_;
+    int maxPolls_;
+    int traceTag_ = SPI_TRACE_TAG_NONE;
+    Parser parser_;
+    Packet idle_;
+    Packet command_;
+    std::array<uint8_t, SPI_PKT_SIZE> rx_{};
+};
+
+} // namespace spi
+
+#endif
@@ -0,0 +1,337 @@
+/*
+ * spi_capture.c
+ *
+ *  Binary capture of raw SPI transfers and replay through spi_protocol.
+ *
+ */
+
+#if !defined(_POSIX_C_SOURCE) && (defined(__unix__) || defined(__APPLE__))
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <spi_capture.h>
+#include <spi_protocol.h>
+
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SPI_CAPTURE_HAVE_POSIX 1
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+static uint64_t default_now_ns(void){
+#ifdef SPI_CAPTURE_HAVE_POSIX
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+#else
+    return 0;
+#endif
+}
+
+static void sleep_ns(uint64_t ns){
+#ifdef SPI_CAPTURE_HAVE_POSIX
+    struct timespec ts;
+    ts.tv_sec = (time_t) (ns / 1000000000ull);
+    ts.tv_nsec = (long) (ns % 1000000000ull);
+    nanosleep(&ts, NULL);
+#else
+    (void) ns;
+#endif
+}
+
+static void write_out(SpiCaptureRecorder* recorder, const void* data, int size){
+    if(fwrite(data, 1, size, recorder->file) != (size_t) size){
+        recorder->error = 1;
+    }
+}
+
+static int flush_staged(SpiCaptureRecorder* recorder){
+    if(recorder->bufferUsed > 0){
+        write_out(recorder, recorder->buffer, recorder->bufferUsed);
+        recorder->bufferUsed = 0;
+    }
+    return recorder->error ? SPI_CAPTURE_IO_ERROR : SPI_CAPTURE_OK;
+}
+
+static void stage(SpiCaptureRecorder* recorder, const void* data, int size){
+    if(recorder->buffer == NULL || size > recorder->bufferSize){
+        flush_staged(recorder);
+        write_out(recorder, data, size);
+        return;
+    }
+    if(recorder->bufferUsed + size > recorder->bufferSize){
+        flush_staged(recorder);
+    }
+    memcpy(recorder->buffer + recorder->bufferUsed, data, size);
+    recorder->bufferUsed += size;
+}
+
+static void boundary_mismatch(SpiCaptureReplayStats* stats, uint64_t offset){
+    if(stats->boundaryMismatches == 0){
+        stats->firstMismatchOffset = offset;
+    }
+    stats->boundaryMismatches++;
+}
+
+// End offset of the FRAME record at offset, 0 if there is none there (other record type or end of capture)
+static int read_frame_record(const uint8_t* data, size_t size, size_t offset, uint64_t* end, size_t* next){
+    SpiCaptureRecordHeader header;
+    if(size - offset < sizeof(header)){
+        return 0;
+    }
+    memcpy(&header, data + offset, sizeof(header));
+    if(header.type != SPI_CAPTURE_RECORD_FRAME || header.size < sizeof(*end) || size - offset - sizeof(header) < header.size){
+        return 0;
+    }
+    memcpy(end, data + offset + sizeof(header), sizeof(*end));
+    *next = offset + sizeof(header) + header.size;
+    return 1;
+}
+
+static void record(SpiCaptureRecorder* recorder, uint16_t type, uint64_t timestamp, const uint8_t* data, int size){
+    SpiCaptureRecordHeader header;
+    header.timestamp_ns = timestamp;
+    header.size = (uint32_t) size;
+    header.type = type;
+    header.reserved = 0;
+    stage(recorder, &header, sizeof(header));
+    if(size > 0){
+        stage(recorder, data, size);
+    }
+}
+
+
+int spi_capture_open(SpiCaptureRecorder* recorder, FILE* file, uint8_t* buffer, int buffer_size){
+    recorder->file = file;
+    recorder->now_ns = NULL;
+    recorder->buffer = buffer;
+    recorder->bufferSize = buffer_size;
+    recorder->bufferUsed = 0;
+    recorder->transfers = 0;
+    recorder->frames = 0;
+    recorder->bytes = 0;
+    recorder->rejected = 0;
+    recorder->error = 0;
+
+    SpiCaptureFileHeader header;
+    header.magic = SPI_CAPTURE_MAGIC;
+    header.version = SPI_CAPTURE_VERSION;
+    header.reserved = 0;
+    write_out(recorder, &header, sizeof(header));
+
+    return recorder->error ? SPI_CAPTURE_IO_ERROR : SPI_CAPTURE_OK;
+}
+
+SpiProtocolPacket* spi_capture_parse(SpiCaptureRecorder* recorder, SpiProtocolInstance* instance, const uint8_t* buffer, int size){
+    if(size < 0 || size > SPI_PKT_SIZE){
+        recorder->rejected++;
+        return NULL;
+    }
+
+    uint64_t timestamp = recorder->now_ns ? recorder->now_ns() : default_now_ns();
+    uint64_t transferOffset = recorder->bytes;
+    record(recorder, SPI_CAPTURE_RECORD_TRANSFER, timestamp, buffer, size);
+    recorder->transfers++;
+    recorder->bytes += (uint64_t) size;
+
+    SpiProtocolPacket* packet = spi_protocol_parse(instance, buffer, size);
+    if(packet != NULL){
+        uint64_t end = transferOffset + (uint64_t) instance->lastFrameEnd;
+        record(recorder, SPI_CAPTURE_RECORD_FRAME, timestamp, (const uint8_t*) &end, sizeof(end));
+        recorder->frames++;
+    }
+    return packet;
+}
+
+int spi_capture_parse_batch(SpiCaptureRecorder* recorder, SpiProtocolInstance* instance, const uint8_t* buffer, int size, SpiCaptureReplayCallback callback, void* user){
+    uint64_t timestamp = recorder->now_ns ? recorder->now_ns() : default_now_ns();
+    uint64_t transferOffset = recorder->bytes;
+    record(recorder, SPI_CAPTURE_RECORD_TRANSFER, timestamp, buffer, size);
+    recorder->transfers++;
+    recorder->bytes += (uint64_t) size;
+
+    // Same chunking as replay, a FRAME record for every completed packet
+    int count = 0;
+    for(int offset = 0; offset < size; offset += SPI_PKT_SIZE){
+        int chunk = size - offset < SPI_PKT_SIZE ? size - offset : SPI_PKT_SIZE;
+        SpiProtocolPacket* packet = spi_protocol_parse(instance, buffer + offset, chunk);
+        if(packet != NULL){
+            uint64_t end = transferOffset + (uint64_t) offset + (uint64_t) instance->lastFrameEnd;
+            record(recorder, SPI_CAPTURE_RECORD_FRAME, timestamp, (const uint8_t*) &end, sizeof(end));
+            recorder->frames++;
+            count++;
+            if(callback != NULL){
+                callback(packet, timestamp, user);
+            }
+        }
+    }
+    return count;
+}
+
+int spi_capture_flush(SpiCaptureRecorder* recorder){
+    int ret = flush_staged(recorder);
+    if(fflush(recorder->file) != 0){
+        recorder->error = 1;
+        ret = SPI_CAPTURE_IO_ERROR;
+    }
+    return ret;
+}
+
+
+int spi_capture_replay_buffer(const uint8_t* data, size_t size, SpiProtocolInstance* instance, int realtime, SpiCaptureReplayCallback callback, void* user, SpiCaptureReplayStats* stats){
+    SpiCaptureReplayStats local;
+    if(stats == NULL){
+        stats = &local;
+    }
+    memset(stats, 0, sizeof(*stats));
+
+    SpiCaptureFileHeader fileHeader;
+    if(size < sizeof(fileHeader)){
+        return SPI_CAPTURE_BAD_FORMAT;
+    }
+    memcpy(&fileHeader, data, sizeof(fileHeader));
+    if(fileHeader.magic != SPI_CAPTURE_MAGIC || fileHeader.version < SPI_CAPTURE_VERSION_MIN || fileHeader.version > SPI_CAPTURE_VERSION){
+        return SPI_CAPTURE_BAD_FORMAT;
+    }
+    int checkBoundaries = fileHeader.version >= 2;
+    // FRAME records before this offset were already matched while replaying their transfer
+    size_t matchedUntil = 0;
+
+    size_t offset = sizeof(fileHeader);
+    uint64_t firstRecorded = 0;
+    uint64_t firstReplayed = 0;
+
+    while(offset < size){
+        SpiCaptureRecordHeader header;
+        if(size - offset < sizeof(header)){
+            return SPI_CAPTURE_BAD_FORMAT;
+        }
+        // records aren't aligned in the file, copy header out
+        memcpy(&header, data + offset, sizeof(header));
+        offset += sizeof(header);
+        if(size - offset < header.size){
+            return SPI_CAPTURE_BAD_FORMAT;
+        }
+
+        switch(header.type){
+            case SPI_CAPTURE_RECORD_TRANSFER:
+            {
+                if(realtime){
+                    uint64_t now = default_now_ns();
+                    if(stats->transfers == 0){
+                        firstRecorded = header.timestamp_ns;
+                        firstReplayed = now;
+                    } else {
+                        uint64_t target = firstReplayed + (header.timestamp_ns - firstRecorded);
+                        if(target > now){
+                            sleep_ns(target - now);
+                        }
+                    }
+                }
+
+                // FRAME records of this transfer follow it, matched by end offset as packets complete
+                size_t frameRecord = offset + header.size;
+
+                // spi_protocol_parse takes at most one packet worth of bytes at a time
+                const uint8_t* transfer = data + offset;
+                uint32_t remaining = header.size;
+                while(remaining > 0){
+                    int chunk = remaining < SPI_PKT_SIZE ? (int) remaining : SPI_PKT_SIZE;
+                    SpiProtocolPacket* packet = spi_protocol_parse(instance, transfer, chunk);
+                    if(packet != NULL){
+                        stats->frames++;
+                        if(checkBoundaries){
+                            uint64_t end = stats->bytes + (uint64_t) (transfer - (data + offset)) + (uint64_t) instance->lastFrameEnd;
+                            // Both sides are in stream order, recorded frames ending earlier were missed by replay
+                            uint64_t recordedEnd;
+                            size_t next;
+                            int matched = 0;
+                            while(read_frame_record(data, size, frameRecord, &recordedEnd, &next) && recordedEnd <= end){
+                                frameRecord = next;
+                                if(recordedEnd == end){
+                                    matched = 1;
+                                    break;
+                                }
+                                boundary_mismatch(stats, recordedEnd);
+                            }
+                            if(!matched){
+                                // frame which isn't in the capture
+                                boundary_mismatch(stats, end);
+                            }
+                        }
+                        if(callback != NULL){
+                            callback(packet, header.timestamp_ns, user);
+                        }
+                    }
+                    transfer += chunk;
+                    remaining -= chunk;
+                }
+
+                matchedUntil = frameRecord;
+                stats->transfers++;
+                stats->bytes += header.size;
+            }
+            break;
+
+            case SPI_CAPTURE_RECORD_FRAME:
+            {
+                stats->framesExpected++;
+                if(checkBoundaries){
+                    uint64_t recordedEnd;
+                    if(header.size < sizeof(recordedEnd)){
+                        return SPI_CAPTURE_BAD_FORMAT;
+                    }
+                    memcpy(&recordedEnd, data + offset, sizeof(recordedEnd));
+                    if(offset - sizeof(header) >= matchedUntil){
+                        // recorded frame which replay didn't produce
+                        boundary_mismatch(stats, recordedEnd);
+                    }
+                }
+            }
+            break;
+
+            default:
+                // unknown record types are skipped, newer captures stay readable
+            break;
+        }
+
+        offset += header.size;
+    }
+
+    return SPI_CAPTURE_OK;
+}
+
+int spi_capture_replay(const char* path, SpiProtocolInstance* instance, int realtime, SpiCaptureReplayCallback callback, void* user, SpiCaptureReplayStats* stats){
+#ifdef SPI_CAPTURE_HAVE_POSIX
+    int fd = open(path, O_RDONLY);
+    if(fd < 0){
+        return SPI_CAPTURE_IO_ERROR;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size <= 0){
+        close(fd);
+        return SPI_CAPTURE_IO_ERROR;
+    }
+
+    void* mapped = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(mapped == MAP_FAILED){
+        return SPI_CAPTURE_IO_ERROR;
+    }
+    posix_madvise(mapped, (size_t) st.st_size, POSIX_MADV_SEQUENTIAL);
+
+    int ret = spi_capture_replay_buffer((const uint8_t*) mapped, (size_t) st.st_size, instance, realtime, callback, user, stats);
+
+    munmap(mapped, (size_t) st.st_size);
+    return ret;
+#else
+    (void) path; (void) instance; (void) realtime; (void) callback; (void) user; (void) stats;
+    return SPI_CAPTURE_UNSUPPORTED;
+#endif
+}
@@ -0,0 +1,154 @@
+/*
+ * spi_capture.h
+ *
+ *  Binary capture of raw SPI transfers and replay through spi_protocol.
+ *
+ *  File layout (host byte order):
+ *      SpiCaptureFileHeader
+ *      SpiCaptureRecordHeader [+ size bytes of raw transfer], ...
+ *
+ *  Every transfer is followed by one SPI_CAPTURE_RECORD_FRAME record per valid
+ *  packet it completed (transfers are parsed in SPI_PKT_SIZE chunks). The
+ *  record payload is a uint64_t end offset: the position just past the
+ *  packet's end byte, counted in transfer bytes since the start of the
+ *  capture. Replay compares every boundary it parses against it.
+ *
+ */
+
+#ifndef SHARED_SPI_CAPTURE_H
+#define SHARED_SPI_CAPTURE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <spi_protocol.h>
+
+#define SPI_CAPTURE_MAGIC 0x50414353 // "SCAP"
+#define SPI_CAPTURE_VERSION 2
+// Version 1 FRAME records carry no end offset, only frame counts are compared
+#define SPI_CAPTURE_VERSION_MIN 1
+
+enum SPI_CAPTURE_RECORD_TYPE {
+    SPI_CAPTURE_RECORD_TRANSFER = 0,
+    SPI_CAPTURE_RECORD_FRAME = 1
+};
+
+enum SPI_CAPTURE_RETURN_CODE {
+    SPI_CAPTURE_OK = 0,
+    SPI_CAPTURE_IO_ERROR = -1,
+    SPI_CAPTURE_BAD_FORMAT = -2,
+    SPI_CAPTURE_UNSUPPORTED = -3
+};
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+} SpiCaptureFileHeader;
+
+typedef struct {
+    uint64_t timestamp_ns;
+    uint32_t size;
+    uint16_t type;
+    uint16_t reserved;
+} SpiCaptureRecordHeader;
+
+typedef struct {
+    FILE* file;
+    // Optional clock, CLOCK_MONOTONIC is used when NULL
+    uint64_t (*now_ns)(void);
+    // Staging buffer, records are written out in batches
+    uint8_t* buffer;
+    int bufferSize;
+    int bufferUsed;
+    uint32_t transfers;
+    uint32_t frames;
+    // Transfer bytes recorded so far, frame end offsets are relative to this stream
+    uint64_t bytes;
+    // Transfers over SPI_PKT_SIZE passed to spi_capture_parse(), not recorded
+    uint32_t rejected;
+    int error;
+} SpiCaptureRecorder;
+
+typedef struct {
+    uint32_t transfers;
+    uint32_t frames;
+    // Frames recorded in the capture, compare with frames to catch parser regressions
+    uint32_t framesExpected;
+    uint64_t bytes;
+    // Frames whose end offset differs from the capture, or that only one side produced
+    uint32_t boundaryMismatches;
+    // Recorded end offset of the first mismatch (replayed one if the capture has no frame there)
+    uint64_t firstMismatchOffset;
+} SpiCaptureReplayStats;
+
+typedef void (*SpiCaptureReplayCallback)(const SpiProtocolPacket* packet, uint64_t timestamp_ns, void* user);
+
+
+/**
+ * Starts a capture, writes the file header
+ *
+ * @param recorder Recorder to initialize
+ * @param file Opened (binary) output file
+ * @param buffer Staging buffer for batching writes, may be NULL for unbuffered recording
+ * @param buffer_size Size of staging buffer
+ * @returns 0 OK, -1 write failed
+ */
+int spi_capture_open(SpiCaptureRecorder* recorder, FILE* file, uint8_t* buffer, int buffer_size);
+
+/**
+ * Records a raw transfer and passes it on to spi_protocol_parse()
+ *
+ * @param size Transfer size, max SPI_PKT_SIZE like spi_protocol_parse(). Larger transfers
+ *             are not recorded (counted in rejected), use spi_capture_parse_batch() for those
+ * @returns same as spi_protocol_parse(), NULL if the transfer was rejected
+ */
+SpiProtocolPacket* spi_capture_parse(SpiCaptureRecorder* recorder, SpiProtocolInstance* instance, const uint8_t* buffer, int size);
+
+/**
+ * Records a raw transfer of any size (eg. a DMA batch) and parses it in SPI_PKT_SIZE chunks
+ *
+ * @param callback Called for every completed packet, may be NULL
+ * @returns number of packets parsed
+ */
+int spi_capture_parse_batch(SpiCaptureRecorder* recorder, SpiProtocolInstance* instance, const uint8_t* buffer, int size, SpiCaptureReplayCallback callback, void* user);
+
+/**
+ * Writes out staged records
+ *
+ * @returns 0 OK, -1 if any write since spi_capture_open failed
+ */
+int spi_capture_flush(SpiCaptureRecorder* recorder);
+
+
+/**
+ * Replays an in-memory capture through spi_protocol_parse()
+ *
+ * @param data Capture contents, including file header
+ * @param size Size of capture
+ * @param instance Initialized spi protocol instance
+ * @param realtime 0 - as fast as possible, 1 - keep recorded inter-transfer timing
+ * @param callback Called for every parsed packet, may be NULL
+ * @param stats Optional replay statistics, boundaryMismatches is 0 if every frame ended where it did when recorded
+ * @returns 0 OK, -2 malformed capture
+ */
+int spi_capture_replay_buffer(const uint8_t* data, size_t size, SpiProtocolInstance* instance, int realtime, SpiCaptureReplayCallback callback, void* user, SpiCaptureReplayStats* stats);
+
+/**
+ * Maps a capture file and replays it, see spi_capture_replay_buffer()
+ *
+ * @returns 0 OK, -1 file can't be opened/mapped, -2 malformed capture, -3 no mmap on this platform
+ */
+int spi_capture_replay(const char* path, SpiProtocolInstance* instance, int realtime, SpiCaptureReplayCallback callback, void* user, SpiCaptureReplayStats* stats);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
@@ -0,0 +1,109 @@
+/*
+ * spi_device.c
+ *
+ *  Device side helpers: table-driven command dispatch and response streaming.
+ *
+ */
+
+#include <spi_device.h>
+#include <spi_messaging.h>
+#include <spi_messaging_internal.h>
+#include <spi_protocol.h>
+
+#include <stddef.h>
+
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+
+
+void spi_dispatcher_init(SpiDispatcher* dispatcher, const SpiCommandEntry* entries, int num_entries, void* user){
+    dispatcher->entries = entries;
+    dispatcher->numEntries = num_entries;
+    dispatcher->user = user;
+}
+
+int spi_dispatch(const SpiDispatcher* dispatcher, const SpiProtocolPacket* packet){
+    if(packet == NULL){
+        return SPI_DEVICE_PACKET_NULL;
+    }
+
+    // Host bytes are untrusted, spi_parse_command only asserts the stream name fits
+    if(packet->data[3] > MAX_STREAMNAME){
+        return SPI_DEVICE_INVALID_COMMAND;
+    }
+
+    SpiCmdMessage message;
+    spi_parse_command(&message, (uint8_t*) packet->data);
+
+    for(int i = 0; i < dispatcher->numEntries; i++){
+        if(dispatcher->entries[i].cmd == (spi_command) message.cmd && dispatcher->entries[i].handler != NULL){
+            return dispatcher->entries[i].handler(&message, dispatcher->user);
+        }
+    }
+
+    return SPI_DEVICE_NO_HANDLER;
+}
+
+
+void spi_streamer_init(SpiResponseStreamer* streamer, const uint8_t* data, uint32_t size){
+    streamer->data = data;
+    streamer->size = size;
+    streamer->offset = 0;
+}
+
+void spi_streamer_init_part(SpiResponseStreamer* streamer, const uint8_t* data, uint32_t size, const SpiCmdMessage* message){
+    // Clamp requested range to message
+    uint32_t offset = MIN(message->extra_offset, size);
+    uint32_t partSize = MIN(message->extra_size, size - offset);
+    spi_streamer_init(streamer, data + offset, partSize);
+}
+
+int spi_streamer_next(SpiResponseStreamer* streamer, SpiProtocolPacket* packet){
+    uint32_t remaining = streamer->size - streamer->offset;
+    if(remaining == 0){
+        return 0;
+    }
+
+    int numBytes = (int) MIN(remaining, (uint32_t) SPI_PROTOCOL_PAYLOAD_SIZE);
+
+    // Message bytes go straight into the outgoing frame, no staging buffer
+    spi_protocol_write_packet(packet, streamer->data + streamer->offset, numBytes);
+
+    streamer->offset += numBytes;
+    return numBytes;
+}
+
+int spi_streamer_fill(SpiResponseStreamer* streamer, SpiProtocolPacket* packets, int max_packets){
+    int count = 0;
+    while(count < max_packets && spi_streamer_next(streamer, packets + count) > 0){
+        count++;
+    }
+    return count;
+}
+
+uint32_t spi_streamer_remaining(const SpiResponseStreamer* streamer){
+    return streamer->size - streamer->offset;
+}
+
+
+void spi_send_receiver_start(SpiSendReceiver* receiver, uint32_t size){
+    receiver->active = 1;
+    receiver->size = size;
+    receiver->received = 0;
+}
+
+uint32_t spi_send_receiver_accept(SpiSendReceiver* receiver, const uint8_t* payload, const uint8_t** data){
+    uint32_t chunk = read_uint16((uint8_t*) payload + 4);
+    if(!receiver->active || read_uint32((uint8_t*) payload) != receiver->received){
+        return 0;
+    }
+    if(chunk > SPI_SEND_DATA_CHUNK || chunk > receiver->size - receiver->received){
+        return 0;
+    }
+    *data = payload + SPI_SEND_DATA_HEADER_SIZE;
+    receiver->received += chunk;
+    return chunk;
+}
+
+uint32_t spi_send_receiver_credits(const SpiSendReceiver* receiver, uint8_t* data, uint32_t free_space){
+    return spi_generate_send_credits_resp(data, receiver->active, receiver->received, free_space);
+}
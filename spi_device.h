@@ -0,0 +1,141 @@
+/*
+ * spi_device.h
+ *
+ *  Device side helpers: table-driven command dispatch and response streaming.
+ *
+ */
+
+#ifndef SHARED_SPI_DEVICE_H
+#define SHARED_SPI_DEVICE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <spi_protocol.h>
+#include <spi_messaging.h>
+
+enum SPI_DEVICE_RETURN_CODE {
+    SPI_DEVICE_OK = 0,
+    SPI_DEVICE_PACKET_NULL = -1,
+    SPI_DEVICE_NO_HANDLER = -2,
+    SPI_DEVICE_INVALID_COMMAND = -3
+};
+
+typedef int (*SpiCommandHandler)(const SpiCmdMessage* message, void* user);
+
+typedef struct {
+    spi_command cmd;
+    SpiCommandHandler handler;
+} SpiCommandEntry;
+
+typedef struct {
+    const SpiCommandEntry* entries;
+    int numEntries;
+    void* user;
+} SpiDispatcher;
+
+typedef struct {
+    const uint8_t* data;
+    uint32_t size;
+    uint32_t offset;
+} SpiResponseStreamer;
+
+// Receiving side of a SEND_DATA upload, see SPI_SEND_DATA_HEADER_SIZE
+typedef struct {
+    uint8_t active;
+    uint32_t size;
+    // next expected offset, reported as received in GET_SEND_CREDITS responses
+    uint32_t received;
+} SpiSendReceiver;
+
+
+/**
+ * Initializes a dispatcher over a (usually static const) handler table
+ *
+ * @param dispatcher Dispatcher to initialize
+ * @param entries Handler table, one entry per handled spi_command
+ * @param num_entries Number of entries in table
+ * @param user Passed to every handler
+ */
+void spi_dispatcher_init(SpiDispatcher* dispatcher, const SpiCommandEntry* entries, int num_entries, void* user);
+
+/**
+ * Parses the command in a received packet and calls its handler
+ *
+ * @returns handler return value, -1 packet is NULL, -2 no handler for command, -3 malformed command (stream name too long)
+ */
+int spi_dispatch(const SpiDispatcher* dispatcher, const SpiProtocolPacket* packet);
+
+
+/**
+ * Sets up streaming of a queued message buffer. The buffer must stay valid until streaming is done.
+ *
+ * @param streamer Streamer to initialize
+ * @param data Message buffer
+ * @param size Message size
+ */
+void spi_streamer_init(SpiResponseStreamer* streamer, const uint8_t* data, uint32_t size);
+
+/**
+ * Same as spi_streamer_init(), but limited to the range requested by a GET_MESSAGE_PART command
+ */
+void spi_streamer_init_part(SpiResponseStreamer* streamer, const uint8_t* data, uint32_t size, const SpiCmdMessage* message);
+
+/**
+ * Writes the next chunk of the message directly into a packet (eg. DMA TX buffer) and finalizes it in place
+ *
+ * @param streamer Streamer
+ * @param packet Packet to write the frame into
+ * @returns number of message bytes in the frame, 0 when the message is fully streamed
+ */
+int spi_streamer_next(SpiResponseStreamer* streamer, SpiProtocolPacket* packet);
+
+/**
+ * Fills up to max_packets consecutive frames, eg. a whole DMA descriptor ring at once
+ *
+ * With the default layout the packets form one contiguous buffer of SPI_PKT_SIZE frames.
+ * Under SPI_PROTOCOL_ALIGNED_LAYOUT they are sizeof(SpiProtocolPacket) (320 bytes) apart
+ * and SPI_PROTOCOL_FRAME(&packets[i]) is misaligned, so each frame is sent through the
+ * three descriptors of spi_protocol_packet_segments(), see spi_protocol.h.
+ *
+ * @returns number of frames written
+ */
+int spi_streamer_fill(SpiResponseStreamer* streamer, SpiProtocolPacket* packets, int max_packets);
+
+uint32_t spi_streamer_remaining(const SpiResponseStreamer* streamer);
+
+
+/**
+ * Starts a new upload, on every SEND_DATA command. Initialize with size 0 and active 0 at boot (zeroed).
+ *
+ * @param size Upload size, metadata_size + extra_size of the SEND_DATA command
+ */
+void spi_send_receiver_start(SpiSendReceiver* receiver, uint32_t size);
+
+/**
+ * Accepts the chunk of a received SEND_DATA frame if it is the next one expected (go-back-N).
+ * Chunks at any other offset (after a lost frame, or resent ones already accepted) are discarded.
+ *
+ * @param payload Frame payload
+ * @param data Set to the chunk bytes inside payload when accepted
+ * @returns number of bytes accepted, 0 if the chunk was discarded or no upload is in progress
+ */
+uint32_t spi_send_receiver_accept(SpiSendReceiver* receiver, const uint8_t* payload, const uint8_t** data);
+
+/**
+ * Writes the GET_SEND_CREDITS response for the upload
+ *
+ * @param free_space Bytes the device can buffer beyond what it received
+ * @returns response size
+ */
+uint32_t spi_send_receiver_credits(const SpiSendReceiver* receiver, uint8_t* data, uint32_t free_space);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
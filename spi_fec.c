@@ -0,0 +1,111 @@
+/*
+ * spi_fec.c
+ *
+ *  Optional forward error correction on top of spi_protocol.
+ *
+ */
+
+#include <spi_fec.h>
+#include <spi_protocol.h>
+
+#include <string.h>
+
+#define BAD_NONE      (-1)
+#define BAD_MULTIPLE  (-2)
+
+
+// Plain loop over a fixed size, compilers vectorize this
+static void xor_payload(uint8_t* dst, const uint8_t* src){
+    for(int i = 0; i < SPI_PROTOCOL_PAYLOAD_SIZE; i++){
+        dst[i] ^= src[i];
+    }
+}
+
+static void reset_decoder_group(SpiFecDecoder* decoder){
+    decoder->count = 0;
+    decoder->bad = BAD_NONE;
+    memset(decoder->parity, 0, SPI_PROTOCOL_PAYLOAD_SIZE);
+}
+
+
+int spi_fec_encoder_init(SpiFecEncoder* encoder, int group_size){
+    if(group_size < 1 || group_size > SPI_FEC_MAX_GROUP){
+        return SPI_FEC_INVALID_GROUP;
+    }
+    encoder->groupSize = group_size;
+    encoder->count = 0;
+    memset(encoder->parity, 0, SPI_PROTOCOL_PAYLOAD_SIZE);
+    return SPI_FEC_OK;
+}
+
+int spi_fec_encode(SpiFecEncoder* encoder, const SpiProtocolPacket* packet){
+    xor_payload(encoder->parity, packet->data);
+    encoder->count++;
+    return encoder->count >= encoder->groupSize;
+}
+
+int spi_fec_write_parity(SpiFecEncoder* encoder, SpiProtocolPacket* packet){
+    int ret = spi_protocol_write_packet(packet, encoder->parity, SPI_PROTOCOL_PAYLOAD_SIZE);
+    encoder->count = 0;
+    memset(encoder->parity, 0, SPI_PROTOCOL_PAYLOAD_SIZE);
+    return ret;
+}
+
+
+int spi_fec_decoder_init(SpiFecDecoder* decoder, int group_size){
+    if(group_size < 1 || group_size > SPI_FEC_MAX_GROUP){
+        return SPI_FEC_INVALID_GROUP;
+    }
+    decoder->groupSize = group_size;
+    decoder->repaired = 0;
+    decoder->unrecoverable = 0;
+    memset(decoder->valid, 0, sizeof(decoder->valid));
+    reset_decoder_group(decoder);
+    return SPI_FEC_OK;
+}
+
+int spi_fec_decode(SpiFecDecoder* decoder, const uint8_t* frame){
+    int ok = spi_protocol_check_frame(frame);
+
+    if(decoder->count < decoder->groupSize){
+        // Data frame, keep it until the group is complete
+        int index = decoder->count;
+        spi_protocol_frame_to_packet(frame, &decoder->packets[index]);
+        decoder->valid[index] = (uint8_t) ok;
+        if(ok){
+            xor_payload(decoder->parity, decoder->packets[index].data);
+        } else {
+            decoder->bad = (decoder->bad == BAD_NONE) ? index : BAD_MULTIPLE;
+        }
+        decoder->count++;
+        return 0;
+    }
+
+    // Parity frame completes the group
+    if(decoder->bad >= 0){
+        SpiProtocolPacket* lost = &decoder->packets[decoder->bad];
+        if(ok){
+            // XOR of parity and all good payloads is the lost payload
+            xor_payload(decoder->parity, frame + 1);
+            memcpy(lost->data, decoder->parity, SPI_PROTOCOL_PAYLOAD_SIZE);
+            spi_protocol_inplace_packet(lost);
+            decoder->valid[decoder->bad] = 1;
+            decoder->repaired++;
+        } else {
+            decoder->unrecoverable++;
+        }
+    } else if(decoder->bad == BAD_MULTIPLE){
+        decoder->unrecoverable++;
+    }
+
+    int released = decoder->groupSize;
+    reset_decoder_group(decoder);
+    return released;
+}
+
+const SpiProtocolPacket* spi_fec_decoder_packet(const SpiFecDecoder* decoder, int index){
+    if(index < 0 || index >= decoder->groupSize || !decoder->valid[index]){
+        return NULL;
+    }
+    return &decoder->packets[index];
+}
@@ -0,0 +1,101 @@
+/*
+ * spi_fec.h
+ *
+ *  Optional forward error correction on top of spi_protocol.
+ *
+ *  Every group of group_size data frames is followed by one parity frame,
+ *  whose payload is the XOR of the group's payloads. A single frame per group
+ *  failing its CRC is rebuilt from the parity and the remaining frames,
+ *  without a re-request. Both ends have to agree on FEC mode and group size,
+ *  and frames must arrive at fixed positions (one frame per SPI_PKT_SIZE
+ *  transfer), so the decoder knows which frame of a group it is looking at.
+ *
+ *  Decoded packets are released per group, adding group_size frames of latency.
+ *
+ */
+
+#ifndef SHARED_SPI_FEC_H
+#define SHARED_SPI_FEC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <spi_protocol.h>
+
+#define SPI_FEC_MAX_GROUP 16
+
+enum SPI_FEC_RETURN_CODE {
+    SPI_FEC_OK = 0,
+    SPI_FEC_INVALID_GROUP = -1
+};
+
+typedef struct {
+    int groupSize;
+    int count;
+    uint8_t parity[SPI_PROTOCOL_PAYLOAD_SIZE];
+} SpiFecEncoder;
+
+typedef struct {
+    int groupSize;
+    int count;
+    // index of the failed frame in group, -1 none, -2 more than one
+    int bad;
+    uint8_t parity[SPI_PROTOCOL_PAYLOAD_SIZE];
+    SpiProtocolPacket packets[SPI_FEC_MAX_GROUP];
+    uint8_t valid[SPI_FEC_MAX_GROUP];
+
+    uint32_t repaired;
+    uint32_t unrecoverable;
+} SpiFecDecoder;
+
+
+/**
+ * @param group_size Data frames per parity frame (1 - SPI_FEC_MAX_GROUP)
+ * @returns 0 OK, -1 invalid group size
+ */
+int spi_fec_encoder_init(SpiFecEncoder* encoder, int group_size);
+
+/**
+ * Adds a finished data packet to the current group
+ *
+ * @returns 1 if the group is complete and spi_fec_write_parity() has to be sent next, 0 otherwise
+ */
+int spi_fec_encode(SpiFecEncoder* encoder, const SpiProtocolPacket* packet);
+
+/**
+ * Writes the parity packet of the current group and starts a new group
+ *
+ * @returns 0 OK, -1 packet is NULL
+ */
+int spi_fec_write_parity(SpiFecEncoder* encoder, SpiProtocolPacket* packet);
+
+
+/**
+ * @param group_size Data frames per parity frame, must match the encoder
+ * @returns 0 OK, -1 invalid group size
+ */
+int spi_fec_decoder_init(SpiFecDecoder* decoder, int group_size);
+
+/**
+ * Pushes the next received frame (data or parity, in order)
+ *
+ * @param frame SPI_PKT_SIZE bytes as received on the wire
+ * @returns number of data packets released when a group completes (group_size), 0 otherwise.
+ *          Released packets are read with spi_fec_decoder_packet() until the next call.
+ */
+int spi_fec_decode(SpiFecDecoder* decoder, const uint8_t* frame);
+
+/**
+ * @returns released data packet at index of group, NULL if it was lost and couldn't be repaired
+ */
+const SpiProtocolPacket* spi_fec_decoder_packet(const SpiFecDecoder* decoder, int index);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
@@ -7,6 +7,7 @@
  */
 
 #include <spi_messaging.h>
+#include <spi_messaging_internal.h>
 #include <spi_protocol.h>
 
 #include <string.h>
@@ -15,6 +16,35 @@
 
 #include <stdio.h>
 
+static const SpiMessagingTraceHook* traceHook = NULL;
+
+void spi_messaging_set_trace_hook(const SpiMessagingTraceHook* hook){
+    traceHook = hook;
+}
+
+uint64_t spi_messaging_trace_now(void){
+    const SpiMessagingTraceHook* hook = traceHook;
+    return hook ? hook->now_ns(hook->user) : 0;
+}
+
+int spi_messaging_trace_tag(spi_command command, uint8_t stream_name_len, const char* stream_name){
+    const SpiMessagingTraceHook* hook = traceHook;
+    return hook ? hook->tag(hook->user, command, stream_name_len, stream_name) : SPI_TRACE_TAG_NONE;
+}
+
+void spi_messaging_trace_phase(int tag, int phase, uint64_t start_ns){
+    const SpiMessagingTraceHook* hook = traceHook;
+    if(hook != NULL){
+        hook->phase(hook->user, tag, phase, start_ns, hook->now_ns(hook->user));
+    }
+}
+
+static void trace_encode(const SpiMessagingTraceHook* hook, spi_command command, uint8_t stream_name_len, const char* stream_name, uint64_t start){
+    if(hook != NULL){
+        hook->encoded(hook->user, command, stream_name_len, stream_name, start, hook->now_ns(hook->user));
+    }
+}
+
 
 uint8_t is_little_endian(){
     uint16_t i = 1;
@@ -54,6 +84,34 @@ uint32_t read_uint32(uint8_t* currPtr){
     return result;
 }
 
+void write_uint16(uint8_t* currPtr, uint16_t value){
+    if(is_little_endian()){
+        for(size_t i=0; i<sizeof(uint16_t); i++){
+            *currPtr = (value >> (i*8)) & 0xFF;
+            currPtr++;
+        }
+    } else {
+        for(size_t i=0; i<sizeof(uint16_t); i++){
+            *currPtr = (value >> ((sizeof(uint16_t)-i-1)*8)) & 0xFF;
+            currPtr++;
+        }
+    }
+}
+
+void write_uint32(uint8_t* currPtr, uint32_t value){
+    if(is_little_endian()){
+        for(size_t i=0; i<sizeof(uint32_t); i++){
+            *currPtr = (value >> (i*8)) & 0xFF;
+            currPtr++;
+        }
+    } else {
+        for(size_t i=0; i<sizeof(uint32_t); i++){
+            *currPtr = (value >> ((sizeof(uint32_t)-i-1)*8)) & 0xFF;
+            currPtr++;
+        }
+    }
+}
+
 
 uint8_t isGetSizeCmd(spi_command cmd){
     uint8_t result = 0;
@@ -77,6 +135,9 @@ uint8_t isGetMessageCmd(spi_command cmd){
 
 
 void spi_generate_command(SpiProtocolPacket* spiPacket, spi_command command, uint8_t stream_name_len, const char* stream_name){
+    const SpiMessagingTraceHook* hook = traceHook;
+    uint64_t start = hook ? hook->now_ns(hook->user) : 0;
+
     SpiCmdMessage spi_message;
 
     assert(stream_name_len <= MAX_STREAMNAME);
@@ -89,9 +150,14 @@ void spi_generate_command(SpiProtocolPacket* spiPacket, spi_command command, uin
     strncpy(spi_message.stream_name, stream_name, stream_name_len);
 
     spi_protocol_write_packet(spiPacket, (uint8_t*) &spi_message, spi_message.total_size);
+
+    trace_encode(hook, command, stream_name_len, stream_name, start);
 }
 
 void spi_generate_command_partial(SpiProtocolPacket* spiPacket, spi_command command, uint8_t stream_name_len, const char* stream_name, uint32_t offset, uint32_t offset_size){
+    const SpiMessagingTraceHook* hook = traceHook;
+    uint64_t start = hook ? hook->now_ns(hook->user) : 0;
+
     SpiCmdMessage spi_message;
 
     assert(stream_name_len <= MAX_STREAMNAME);
@@ -104,9 +170,14 @@ void spi_generate_command_partial(SpiProtocolPacket* spiPacket, spi_command comm
     strncpy(spi_message.stream_name, stream_name, stream_name_len);
 
     spi_protocol_write_packet(spiPacket, (uint8_t*) &spi_message, spi_message.total_size);
+
+    trace_encode(hook, command, stream_name_len, stream_name, start);
 }
 
 void spi_generate_command_send(SpiProtocolPacket* spiPacket, spi_command command, uint8_t stream_name_len, const char* stream_name, uint32_t metadata_size, uint32_t send_data_size){
+    const SpiMessagingTraceHook* hook = traceHook;
+    uint64_t start = hook ? hook->now_ns(hook->user) : 0;
+
     SpiCmdMessage spi_message;
 
     assert(stream_name_len <= MAX_STREAMNAME);
@@ -120,6 +191,8 @@ void spi_generate_command_send(SpiProtocolPacket* spiPacket, spi_command command
     strncpy(spi_message.stream_name, stream_name, stream_name_len);
 
     spi_protocol_write_packet(spiPacket, (uint8_t*) &spi_message, spi_message.total_size);
+
+    trace_encode(hook, command, stream_name_len, stream_name, start);
 }
 
 void spi_parse_command(SpiCmdMessage* parsed_message, uint8_t* data){
@@ -173,6 +246,94 @@ void spi_parse_get_streams_resp(SpiGetStreamsResp* parsedResp, uint8_t* data){
     }
 }
 
+void spi_parse_get_ready_resp(SpiGetReadyResp* parsedResp, uint8_t* data){
+    uint8_t *currPtr = data;
+
+    parsedResp->numStreams = *currPtr;
+    currPtr++;
+    assert(parsedResp->numStreams <= MAX_STREAMS);
+
+    parsedResp->ready_mask = read_uint16(currPtr);
+    currPtr = currPtr+2;
+
+    // sizes are only sent for streams which have a pending message
+    for(int i=0; i < MAX_STREAMS; i++){
+        if(i < parsedResp->numStreams && (parsedResp->ready_mask & (1u << i))){
+            parsedResp->sizes[i] = read_uint32(currPtr);
+            currPtr = currPtr+4;
+        } else {
+            parsedResp->sizes[i] = 0;
+        }
+    }
+}
+
+uint32_t spi_generate_get_ready_resp(uint8_t* data, const SpiGetReadyResp* resp){
+    uint8_t *currPtr = data;
+
+    assert(resp->numStreams <= MAX_STREAMS);
+    *currPtr = resp->numStreams;
+    currPtr++;
+
+    write_uint16(currPtr, resp->ready_mask);
+    currPtr = currPtr+2;
+
+    for(int i=0; i < resp->numStreams; i++){
+        if(resp->ready_mask & (1u << i)){
+            write_uint32(currPtr, resp->sizes[i]);
+            currPtr = currPtr+4;
+        }
+    }
+
+    return (uint32_t) (currPtr - data);
+}
+
+void spi_parse_send_credits_resp(SpiSendCreditsResp* parsedResp, uint8_t* data){
+    parsedResp->limit = read_uint32(data);
+    parsedResp->received = read_uint32(data + 4);
+    parsedResp->active = data[8];
+}
+
+uint32_t spi_generate_send_credits_resp(uint8_t* data, uint8_t active, uint32_t received, uint32_t free_space){
+    write_uint32(data, received + free_space);
+    write_uint32(data + 4, received);
+    data[8] = active;
+    return 9;
+}
+
+uint32_t spi_generate_send_data(SpiProtocolPacket* spiPacket, uint32_t offset, const uint8_t* data, uint32_t size){
+    uint8_t header[SPI_SEND_DATA_HEADER_SIZE];
+    uint32_t chunk = size < SPI_SEND_DATA_CHUNK ? size : SPI_SEND_DATA_CHUNK;
+    write_uint32(header, offset);
+    write_uint16(header + 4, (uint16_t) chunk);
+    spi_protocol_write_packet2(spiPacket, header, data, SPI_SEND_DATA_HEADER_SIZE, (int) chunk);
+    return chunk;
+}
+
+void spi_send_window_init(SpiSendWindow* window){
+    window->sent = 0;
+    window->limit = 0;
+}
+
+int spi_send_window_update(SpiSendWindow* window, const SpiSendCreditsResp* resp){
+    window->sent = 0;
+    window->limit = 0;
+    if(!resp->active){
+        return SPI_SEND_WINDOW_RESTART;
+    }
+    window->sent = resp->received;
+    window->limit = resp->limit;
+    return SPI_SEND_WINDOW_OK;
+}
+
+uint32_t spi_send_window_available(const SpiSendWindow* window){
+    return window->limit > window->sent ? window->limit - window->sent : 0;
+}
+
+void spi_send_window_consume(SpiSendWindow* window, uint32_t size){
+    assert(size <= spi_send_window_available(window));
+    window->sent += size;
+}
+
 void spi_parse_get_message(SpiGetMessageResp* parsedResp, uint32_t size, spi_command get_mess_cmd){
     switch(get_mess_cmd){
         case GET_MESSAGE: {
@@ -32,6 +32,15 @@ typedef enum{
     SEND_DATA,
     // Gets message fast (TODO)
     GET_MESSAGE_FAST,
+
+    // SpiGetReadyResp commands
+    GET_READY_STREAMS,
+
+    // Metadata delta against a cached version (see spi_metadata.h)
+    GET_METADATA_DELTA,
+
+    // SpiSendCreditsResp commands
+    GET_SEND_CREDITS,
 } spi_command;
 static const spi_command GET_SIZE_CMDS[] = {GET_SIZE, GET_METASIZE};
 static const spi_command GET_MESS_CMDS[] = {GET_MESSAGE, GET_METADATA, GET_MESSAGE_PART};
@@ -68,6 +77,53 @@ typedef struct {
     char stream_names[MAX_STREAMS][MAX_STREAMNAME];
 } SpiGetStreamsResp;
 
+// Streams are indexed in the order returned by GET_STREAMS.
+// On the wire: numStreams (1B), ready_mask (2B), then a 4B size for each set bit only.
+typedef struct {
+    uint8_t numStreams;
+    uint16_t ready_mask;
+    uint32_t sizes[MAX_STREAMS];
+} SpiGetReadyResp;
+
+// SEND_DATA upload frames: a 4B offset of the chunk within the upload (metadata + data), its 2B size,
+// then up to SPI_SEND_DATA_CHUNK bytes. The device only accepts the chunk at the offset it expects next and
+// discards everything else (go-back-N), so a frame lost to a CRC error is never skipped over.
+#define SPI_SEND_DATA_HEADER_SIZE 6
+#define SPI_SEND_DATA_CHUNK (SPI_PROTOCOL_PAYLOAD_SIZE - SPI_SEND_DATA_HEADER_SIZE)
+
+// Credit based flow control for SEND_DATA uploads, one window per stream.
+// Unit: upload bytes (metadata + data), frame headers and padding aren't counted.
+// Counters are per upload and start at 0 with every SEND_DATA command. received is the number of
+// bytes accepted in order (the next offset the device expects), limit = received + free buffer space.
+// active is 0 if the device has no upload in progress on the stream (eg. it restarted).
+typedef struct {
+    uint32_t limit;
+    uint32_t received;
+    uint8_t active;
+} SpiSendCreditsResp;
+
+// Host side view of the send window of the current upload of a stream
+typedef struct {
+    uint32_t sent;
+    uint32_t limit;
+} SpiSendWindow;
+
+enum SPI_SEND_WINDOW_RETURN_CODE {
+    SPI_SEND_WINDOW_OK = 0,
+    SPI_SEND_WINDOW_RESTART = -1
+};
+
+// Optional tracing hook, see spi_trace.h (spi_trace_install). now_ns and all callbacks must be set.
+// encoded is called by every spi_generate_command* function. tag maps a command and stream to an
+// opaque tag, which phase records any other phase (spi_trace_phase values) against.
+typedef struct {
+    uint64_t (*now_ns)(void* user);
+    void (*encoded)(void* user, spi_command command, uint8_t stream_name_len, const char* stream_name, uint64_t start_ns, uint64_t end_ns);
+    int (*tag)(void* user, spi_command command, uint8_t stream_name_len, const char* stream_name);
+    void (*phase)(void* user, int tag, int phase, uint64_t start_ns, uint64_t end_ns);
+    void* user;
+} SpiMessagingTraceHook;
+
 uint8_t isGetSizeCmd(spi_command cmd);
 uint8_t isGetMessageCmd(spi_command cmd);
 
@@ -79,9 +135,32 @@ void spi_parse_command(SpiCmdMessage* message, uint8_t* data);
 void spi_parse_get_size_resp(SpiGetSizeResp* parsedResp, uint8_t* data);
 void spi_status_resp(SpiStatusResp* parsedResp, uint8_t* data);
 void spi_parse_get_streams_resp(SpiGetStreamsResp* parsedResp, uint8_t* data);
+void spi_parse_get_ready_resp(SpiGetReadyResp* parsedResp, uint8_t* data);
+uint32_t spi_generate_get_ready_resp(uint8_t* data, const SpiGetReadyResp* resp);
+void spi_parse_send_credits_resp(SpiSendCreditsResp* parsedResp, uint8_t* data);
+uint32_t spi_generate_send_credits_resp(uint8_t* data, uint8_t active, uint32_t received, uint32_t free_space);
+
+// Writes the upload chunk at offset into a frame, returns number of data bytes it holds (max SPI_SEND_DATA_CHUNK)
+uint32_t spi_generate_send_data(SpiProtocolPacket* spiPacket, uint32_t offset, const uint8_t* data, uint32_t size);
+
+// Call after issuing SEND_DATA, the window starts closed until the first credits response
+void spi_send_window_init(SpiSendWindow* window);
+// Resyncs to the device: sending continues at offset window->sent (= received), anything past it is resent.
+// Returns SPI_SEND_WINDOW_RESTART if the device has no upload in progress, SEND_DATA has to be issued again
+// and the upload restarted from offset 0. Stale responses are harmless, resent chunks are discarded.
+int spi_send_window_update(SpiSendWindow* window, const SpiSendCreditsResp* resp);
+uint32_t spi_send_window_available(const SpiSendWindow* window);
+void spi_send_window_consume(SpiSendWindow* window, uint32_t size);
 
 void spi_parse_get_message(SpiGetMessageResp* parsedResp, uint32_t size, spi_command get_mess_cmd);
 
+// Tracing, all of these are no-ops while no hook is installed (hook == NULL disables)
+void spi_messaging_set_trace_hook(const SpiMessagingTraceHook* hook);
+uint64_t spi_messaging_trace_now(void);
+// Tag for a command's phases and its response parser (SpiProtocolInstance.traceTag), SPI_TRACE_TAG_NONE without hook
+int spi_messaging_trace_tag(spi_command command, uint8_t stream_name_len, const char* stream_name);
+void spi_messaging_trace_phase(int tag, int phase, uint64_t start_ns);
+
 #ifdef __cplusplus
 }
 #endif
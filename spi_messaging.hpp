@@ -0,0 +1,251 @@
+/*
+ * spi_messaging.hpp
+ *
+ *  Header-only C++20 layer over spi_protocol and spi_messaging.
+ *
+ *  Packets and messages are move-only handles, payloads are exposed as
+ *  std::span views. Nothing here allocates per packet unless a handle is
+ *  explicitly requested.
+ *
+ */
+
+#ifndef SHARED_SPI_MESSAGING_HPP
+#define SHARED_SPI_MESSAGING_HPP
+
+#include <spi_protocol.h>
+#include <spi_messaging.h>
+#include <spi_trace.h>
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace spi {
+
+using PayloadView = std::span<const uint8_t, SPI_PROTOCOL_PAYLOAD_SIZE>;
+using WireView = std::span<const uint8_t, SPI_PKT_SIZE>;
+
+/**
+ * Move-only owner of a single SpiProtocolPacket
+ */
+class Packet {
+public:
+    Packet() = default;
+    Packet(const Packet&) = delete;
+    Packet& operator=(const Packet&) = delete;
+    Packet(Packet&&) noexcept = default;
+    Packet& operator=(Packet&&) noexcept = default;
+
+    static Packet allocate(){
+        Packet packet;
+        packet.packet_ = std::make_unique<SpiProtocolPacket>();
+        return packet;
+    }
+
+    explicit operator bool() const { return packet_ != nullptr; }
+
+    SpiProtocolPacket* get() { return packet_.get(); }
+    const SpiProtocolPacket* get() const { return packet_.get(); }
+
+    PayloadView payload() const { return PayloadView(packet_->data, SPI_PROTOCOL_PAYLOAD_SIZE); }
+
+    // Bytes as they go over the wire, ready to be handed to the SPI transfer
+    WireView wire() const { return WireView(SPI_PROTOCOL_FRAME(packet_.get()), SPI_PKT_SIZE); }
+
+private:
+    std::unique_ptr<SpiProtocolPacket> packet_;
+};
+
+
+/**
+ * Owns a SpiProtocolInstance. Parsed payloads are handed out as views into
+ * the instance storage and are only valid for the duration of the callback.
+ * Use Packet handles (take) when a payload must outlive the next parse.
+ */
+class Parser {
+public:
+    Parser(){ spi_protocol_init(&instance_); }
+    Parser(const Parser&) = delete;
+    Parser& operator=(const Parser&) = delete;
+
+    /**
+     * Parses an arbitrary amount of bytes, invoking onPayload(PayloadView) for every complete packet
+     *
+     * @returns number of packets parsed
+     */
+    template <typename F>
+    int parse(std::span<const uint8_t> bytes, F&& onPayload){
+        int count = 0;
+        // spi_protocol_parse accepts at most one packet worth of bytes, which can complete at most one packet
+        while(!bytes.empty()){
+            size_t chunk = bytes.size() < SPI_PKT_SIZE ? bytes.size() : SPI_PKT_SIZE;
+            SpiProtocolPacket* packet = spi_protocol_parse(&instance_, bytes.data(), (int) chunk);
+            if(packet != nullptr){
+                last_ = packet;
+                onPayload(PayloadView(packet->data, SPI_PROTOCOL_PAYLOAD_SIZE));
+                count++;
+            }
+            bytes = bytes.subspan(chunk);
+        }
+        return count;
+    }
+
+    /**
+     * Moves the most recently parsed packet into an owning handle (one copy, out of instance storage)
+     *
+     * @returns empty Packet if nothing was parsed since the last take
+     */
+    Packet take(){
+        if(last_ == nullptr){
+            return Packet();
+        }
+        Packet packet = Packet::allocate();
+        std::memcpy(packet.get(), last_, sizeof(SpiProtocolPacket));
+        last_ = nullptr;
+        return packet;
+    }
+
+    SpiProtocolInstance* get() { return &instance_; }
+
+    // Attributes CRC time of the following parses to a command, see trace_tag()
+    void set_trace_tag(int tag){ instance_.traceTag = tag; }
+
+private:
+    SpiProtocolInstance instance_;
+    const SpiProtocolPacket* last_ = nullptr;
+};
+
+
+/**
+ * Move-only, reassembled GET_MESSAGE / GET_METADATA / GET_MESSAGE_PART response
+ */
+class Message {
+public:
+    Message() = default;
+    // traceTag attributes REASSEMBLY to the requesting command, see trace_tag()
+    explicit Message(size_t expectedSize, int traceTag = SPI_TRACE_TAG_NONE) : traceTag_(traceTag) { data_.reserve(expectedSize); }
+    Message(const Message&) = delete;
+    Message& operator=(const Message&) = delete;
+    Message(Message&&) noexcept = default;
+    Message& operator=(Message&&) noexcept = default;
+
+    // Appends up to size bytes of a received payload
+    void append(PayloadView payload, size_t size){
+        uint64_t start = spi_messaging_trace_now();
+        if(size > payload.size()){
+            size = payload.size();
+        }
+        data_.insert(data_.end(), payload.begin(), payload.begin() + size);
+        spi_messaging_trace_phase(traceTag_, SPI_TRACE_REASSEMBLY, start);
+    }
+
+    /**
+     * Decodes type and size (metadata trailer for GET_METADATA) once all parts have been appended
+     *
+     * @returns false if the message is too short for its trailer or the trailer size is out of range, data() is empty then
+     */
+    bool finalize(spi_command getMessCmd){
+        dataType_ = 0;
+        dataSize_ = 0;
+
+        // GET_METADATA ends with a type and size trailer of 2 * uint32_t
+        size_t trailer = (getMessCmd == GET_METADATA) ? 2 * sizeof(uint32_t) : 0;
+        if(data_.size() < trailer){
+            return false;
+        }
+
+        SpiGetMessageResp resp;
+        resp.data = data_.data();
+        spi_parse_get_message(&resp, (uint32_t) data_.size(), getMessCmd);
+        if(resp.data_size > data_.size() - trailer){
+            return false;
+        }
+        dataType_ = resp.data_type;
+        dataSize_ = resp.data_size;
+        return true;
+    }
+
+    uint32_t type() const { return dataType_; }
+    std::span<const uint8_t> data() const { return std::span<const uint8_t>(data_.data(), dataSize_ < data_.size() ? dataSize_ : data_.size()); }
+    std::span<uint8_t> raw() { return std::span<uint8_t>(data_); }
+    std::vector<uint8_t> release() && { dataSize_ = 0; return std::move(data_); }
+
+private:
+    std::vector<uint8_t> data_;
+    uint32_t dataType_ = 0;
+    uint32_t dataSize_ = 0;
+    int traceTag_ = SPI_TRACE_TAG_NONE;
+};
+
+
+// Command generation
+
+// Trace tag of a command, for Parser::set_trace_tag, Message and spi_messaging_trace_phase
+inline int trace_tag(spi_command cmd, std::string_view streamName){
+    return spi_messaging_trace_tag(cmd, (uint8_t) streamName.size(), streamName.data());
+}
+
+inline void command(SpiProtocolPacket* packet, spi_command cmd, std::string_view streamName){
+    spi_generate_command(packet, cmd, (uint8_t) streamName.size(), streamName.data());
+}
+
+inline void command_partial(SpiProtocolPacket* packet, spi_command cmd, std::string_view streamName, uint32_t offset, uint32_t size){
+    spi_generate_command_partial(packet, cmd, (uint8_t) streamName.size(), streamName.data(), offset, size);
+}
+
+inline void command_send(SpiProtocolPacket* packet, spi_command cmd, std::string_view streamName, uint32_t metadataSize, uint32_t sendDataSize){
+    spi_generate_command_send(packet, cmd, (uint8_t) streamName.size(), streamName.data(), metadataSize, sendDataSize);
+}
+
+inline Packet command(spi_command cmd, std::string_view streamName){
+    Packet packet = Packet::allocate();
+    command(packet.get(), cmd, streamName);
+    return packet;
+}
+
+
+// Response parsing, straight from a payload view
+
+inline SpiGetSizeResp parse_get_size_resp(PayloadView payload){
+    SpiGetSizeResp resp;
+    spi_parse_get_size_resp(&resp, const_cast<uint8_t*>(payload.data()));
+    return resp;
+}
+
+inline SpiStatusResp parse_status_resp(PayloadView payload){
+    SpiStatusResp resp;
+    spi_status_resp(&resp, const_cast<uint8_t*>(payload.data()));
+    return resp;
+}
+
+inline SpiGetStreamsResp parse_get_streams_resp(PayloadView payload){
+    SpiGetStreamsResp resp;
+    spi_parse_get_streams_resp(&resp, const_cast<uint8_t*>(payload.data()));
+    return resp;
+}
+
+inline SpiGetReadyResp parse_get_ready_resp(PayloadView payload){
+    SpiGetReadyResp resp;
+    spi_parse_get_ready_resp(&resp, const_cast<uint8_t*>(payload.data()));
+    return resp;
+}
+
+inline SpiSendCreditsResp parse_send_credits_resp(PayloadView payload){
+    SpiSendCreditsResp resp;
+    spi_parse_send_credits_resp(&resp, const_cast<uint8_t*>(payload.data()));
+    return resp;
+}
+
+inline SpiCmdMessage parse_command(PayloadView payload){
+    SpiCmdMessage message;
+    spi_parse_command(&message, const_cast<uint8_t*>(payload.data()));
+    return message;
+}
+
+} // namespace spi
+
+#endif
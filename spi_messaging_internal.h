@@ -0,0 +1,18 @@
+/*
+ * spi_messaging_internal.h
+ *
+ *  Byte order helpers shared by the messaging sources. Not part of the public API.
+ *
+ */
+
+#ifndef SHARED_SPI_MESSAGING_INTERNAL_H
+#define SHARED_SPI_MESSAGING_INTERNAL_H
+
+#include <stdint.h>
+
+uint16_t read_uint16(uint8_t* currPtr);
+uint32_t read_uint32(uint8_t* currPtr);
+void write_uint16(uint8_t* currPtr, uint16_t value);
+void write_uint32(uint8_t* currPtr, uint32_t value);
+
+#endif
@@ -0,0 +1,216 @@
+/*
+ * spi_metadata.c
+ *
+ *  Per-stream metadata cache with versioned delta transfer (GET_METADATA_DELTA).
+ *
+ */
+
+#include <spi_metadata.h>
+#include <spi_messaging_internal.h>
+
+#include <string.h>
+
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+
+#define RUN_HEADER_SIZE (4)
+#define MAX_RUN (0xFFFF)
+
+
+static void write_header(uint8_t* out, uint8_t mode, uint32_t version, uint32_t data_type, uint32_t size, uint32_t encoded_size){
+    out[0] = mode;
+    write_uint32(out + 1, version);
+    write_uint32(out + 5, data_type);
+    write_uint32(out + 9, size);
+    write_uint32(out + 13, encoded_size);
+}
+
+/*
+*  Encodes changed byte ranges between old and new as runs of (skip, length, bytes)
+*  returns: encoded size, or -1 if encoding would exceed limit
+*/
+static int encode_delta(const uint8_t* old, const uint8_t* new, uint32_t size, uint8_t* out, uint32_t limit){
+    uint32_t written = 0;
+    uint32_t i = 0;
+
+    while(i < size){
+        // Find next differing byte
+        uint32_t start = i;
+        while(start < size && old[start] == new[start]){
+            start++;
+        }
+        if(start == size){
+            break;
+        }
+
+        // Extend the run, unchanged gaps shorter than a run header are cheaper to include
+        uint32_t end = start + 1;
+        for(uint32_t j = end; j < size && j - start < MAX_RUN && j - end < RUN_HEADER_SIZE; j++){
+            if(old[j] != new[j]){
+                end = j + 1;
+            }
+        }
+
+        // Skips longer than a run header can hold are split into empty runs
+        uint32_t skip = start - i;
+        while(skip > MAX_RUN){
+            if(written + RUN_HEADER_SIZE > limit){
+                return -1;
+            }
+            write_uint16(out + written, MAX_RUN);
+            write_uint16(out + written + 2, 0);
+            written += RUN_HEADER_SIZE;
+            skip -= MAX_RUN;
+        }
+
+        uint32_t length = end - start;
+        if(written + RUN_HEADER_SIZE + length > limit){
+            return -1;
+        }
+        write_uint16(out + written, (uint16_t) skip);
+        write_uint16(out + written + 2, (uint16_t) length);
+        memcpy(out + written + RUN_HEADER_SIZE, new + start, length);
+        written += RUN_HEADER_SIZE + length;
+
+        i = end;
+    }
+
+    return (int) written;
+}
+
+
+void spi_metadata_cache_init(SpiMetadataCache* cache, uint8_t* buffer, uint32_t capacity){
+    cache->version = 0;
+    cache->data_type = 0;
+    cache->size = 0;
+    cache->capacity = capacity;
+    cache->data = buffer;
+}
+
+int spi_metadata_delta_encode(SpiMetadataCache* cache, uint32_t host_version, const uint8_t* metadata, uint32_t size, uint32_t data_type, uint8_t* out, uint32_t out_capacity){
+    if(size > cache->capacity || out_capacity < SPI_METADATA_DELTA_HEADER_SIZE){
+        return SPI_METADATA_NO_SPACE;
+    }
+
+    int hostInSync = (cache->version != 0 && host_version == cache->version);
+    int sameShape = (cache->version != 0 && size == cache->size && data_type == cache->data_type);
+    int unchanged = sameShape && memcmp(cache->data, metadata, size) == 0;
+
+    if(unchanged && hostInSync){
+        write_header(out, SPI_METADATA_UNCHANGED, cache->version, data_type, size, 0);
+        return SPI_METADATA_DELTA_HEADER_SIZE;
+    }
+
+    uint32_t version = cache->version;
+    if(!unchanged){
+        version++;
+        // 0 is reserved for "nothing cached"
+        if(version == 0){
+            version = 1;
+        }
+    }
+
+    uint8_t* payload = out + SPI_METADATA_DELTA_HEADER_SIZE;
+    uint32_t payloadCapacity = out_capacity - SPI_METADATA_DELTA_HEADER_SIZE;
+    int encoded = -1;
+    uint8_t mode = SPI_METADATA_FULL;
+
+    // Delta only pays off if smaller than the metadata itself
+    if(hostInSync && sameShape){
+        encoded = encode_delta(cache->data, metadata, size, payload, MIN(payloadCapacity, size));
+        mode = SPI_METADATA_DELTA;
+    }
+    if(encoded < 0){
+        if(size > payloadCapacity){
+            return SPI_METADATA_NO_SPACE;
+        }
+        memcpy(payload, metadata, size);
+        encoded = (int) size;
+        mode = SPI_METADATA_FULL;
+    }
+
+    write_header(out, mode, version, data_type, size, (uint32_t) encoded);
+
+    memcpy(cache->data, metadata, size);
+    cache->size = size;
+    cache->data_type = data_type;
+    cache->version = version;
+
+    return SPI_METADATA_DELTA_HEADER_SIZE + encoded;
+}
+
+void spi_parse_metadata_delta_header(SpiMetadataDeltaHeader* header, uint8_t* data){
+    header->mode = data[0];
+    header->version = read_uint32(data + 1);
+    header->data_type = read_uint32(data + 5);
+    header->size = read_uint32(data + 9);
+    header->encoded_size = read_uint32(data + 13);
+}
+
+int spi_metadata_delta_apply(SpiMetadataCache* cache, uint8_t* response, uint32_t response_size){
+    if(response_size < SPI_METADATA_DELTA_HEADER_SIZE){
+        return SPI_METADATA_BAD_FORMAT;
+    }
+
+    SpiMetadataDeltaHeader header;
+    spi_parse_metadata_delta_header(&header, response);
+    if(response_size - SPI_METADATA_DELTA_HEADER_SIZE < header.encoded_size){
+        return SPI_METADATA_BAD_FORMAT;
+    }
+    if(header.size > cache->capacity){
+        return SPI_METADATA_NO_SPACE;
+    }
+    uint8_t* payload = response + SPI_METADATA_DELTA_HEADER_SIZE;
+
+    switch(header.mode){
+        case SPI_METADATA_FULL:
+        {
+            if(header.encoded_size != header.size){
+                return SPI_METADATA_BAD_FORMAT;
+            }
+            memcpy(cache->data, payload, header.size);
+        }
+        break;
+
+        case SPI_METADATA_UNCHANGED:
+        {
+            if(cache->version == 0 || header.version != cache->version){
+                return SPI_METADATA_VERSION_MISMATCH;
+            }
+        }
+        break;
+
+        case SPI_METADATA_DELTA:
+        {
+            if(cache->version == 0 || header.size != cache->size){
+                return SPI_METADATA_VERSION_MISMATCH;
+            }
+            uint32_t pos = 0;
+            uint32_t i = 0;
+            while(i < header.encoded_size){
+                if(header.encoded_size - i < RUN_HEADER_SIZE){
+                    return SPI_METADATA_BAD_FORMAT;
+                }
+                uint32_t skip = read_uint16(payload + i);
+                uint32_t length = read_uint16(payload + i + 2);
+                i += RUN_HEADER_SIZE;
+                pos += skip;
+                if(header.encoded_size - i < length || pos > header.size || header.size - pos < length){
+                    return SPI_METADATA_BAD_FORMAT;
+                }
+                memcpy(cache->data + pos, payload + i, length);
+                pos += length;
+                i += length;
+            }
+        }
+        break;
+
+        default:
+            return SPI_METADATA_BAD_FORMAT;
+    }
+
+    cache->version = header.version;
+    cache->data_type = header.data_type;
+    cache->size = header.size;
+
+    return SPI_METADATA_OK;
+}
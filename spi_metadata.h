@@ -0,0 +1,96 @@
+/*
+ * spi_metadata.h
+ *
+ *  Per-stream metadata cache with versioned delta transfer (GET_METADATA_DELTA).
+ *
+ *  Host sends GET_METADATA_DELTA with extra_offset set to the version it has
+ *  cached (0 = nothing cached). Device answers with a SpiMetadataDeltaHeader
+ *  followed by encoded_size bytes:
+ *      SPI_METADATA_FULL       - complete metadata
+ *      SPI_METADATA_UNCHANGED  - nothing, cached version is current
+ *      SPI_METADATA_DELTA      - runs of: skip (2B), length (2B), length new bytes
+ *
+ *  The header carries type and size, so no GET_METASIZE round trip is needed
+ *  and the GET_METADATA type/size trailer doesn't have to be decoded.
+ *
+ */
+
+#ifndef SHARED_SPI_METADATA_H
+#define SHARED_SPI_METADATA_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define SPI_METADATA_DELTA_HEADER_SIZE 17
+
+typedef enum {
+    SPI_METADATA_FULL = 0,
+    SPI_METADATA_UNCHANGED = 1,
+    SPI_METADATA_DELTA = 2
+} spi_metadata_mode;
+
+enum SPI_METADATA_RETURN_CODE {
+    SPI_METADATA_OK = 0,
+    SPI_METADATA_NO_SPACE = -1,
+    SPI_METADATA_VERSION_MISMATCH = -2,
+    SPI_METADATA_BAD_FORMAT = -3
+};
+
+typedef struct {
+    uint8_t mode;
+    uint32_t version;
+    uint32_t data_type;
+    uint32_t size;
+    uint32_t encoded_size;
+} SpiMetadataDeltaHeader;
+
+typedef struct {
+    uint32_t version;
+    uint32_t data_type;
+    uint32_t size;
+    uint32_t capacity;
+    uint8_t* data;
+} SpiMetadataCache;
+
+
+/**
+ * Initializes an empty cache over a caller provided buffer
+ */
+void spi_metadata_cache_init(SpiMetadataCache* cache, uint8_t* buffer, uint32_t capacity);
+
+/**
+ * Device side: encodes the response to GET_METADATA_DELTA and updates the cache
+ *
+ * @param cache Device side cache of the stream
+ * @param host_version Version the host has cached (extra_offset of the command)
+ * @param metadata Current metadata
+ * @param size Current metadata size
+ * @param data_type Current metadata type
+ * @param out Response buffer
+ * @param out_capacity Response buffer size
+ * @returns response size in bytes, -1 if out or cache is too small
+ */
+int spi_metadata_delta_encode(SpiMetadataCache* cache, uint32_t host_version, const uint8_t* metadata, uint32_t size, uint32_t data_type, uint8_t* out, uint32_t out_capacity);
+
+/**
+ * Parses the response header, available from the first response packet
+ */
+void spi_parse_metadata_delta_header(SpiMetadataDeltaHeader* header, uint8_t* data);
+
+/**
+ * Host side: reconstructs metadata in the cache from a complete response
+ *
+ * @returns 0 OK, -1 cache too small, -2 response is relative to a version not in cache, -3 malformed
+ */
+int spi_metadata_delta_apply(SpiMetadataCache* cache, uint8_t* response, uint32_t response_size);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
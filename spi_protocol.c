@@ -15,6 +15,14 @@
 #include <checksum.h>
 
 #include <stdio.h>
+#include <stddef.h>
+
+#ifdef SPI_PROTOCOL_ALIGNED_LAYOUT
+_Static_assert(offsetof(SpiProtocolPacket, data) % SPI_PROTOCOL_DATA_ALIGNMENT == 0, "packet data must be aligned");
+_Static_assert(offsetof(SpiProtocolPacket, crc) % 4 == 0, "trailer segment must be 4-byte aligned");
+#endif
+// start, data, crc and end have to stay contiguous, they are transferred as one frame
+_Static_assert(offsetof(SpiProtocolPacket, end) - offsetof(SpiProtocolPacket, start) == SPI_PKT_SIZE - 1, "frame must be contiguous");
 
 #define MIN(x, y) (((x) < (y)) ? (x) : (y))
 
@@ -24,6 +32,8 @@
 #define STATE_RX_TAIL_CRC_1     (3) // LE second byte CRC
 #define STATE_RX_TAIL_END       (4) // 1 byte end byte
 
+static const SpiProtocolTraceHook* traceHook = NULL;
+
 static SpiProtocolPacket* get_parsed_packet(SpiProtocolInstance* instance){
     assert(instance->currentPacketIndex == 0 || instance->currentPacketIndex == 1);
     return instance->packet + ( 1 - instance->currentPacketIndex);
@@ -73,21 +83,31 @@ void spi_protocol_init(SpiProtocolInstance *instance){
     instance->state = STATE_RX_HEADER;
     instance->payloadOffset = 0;
     instance->currentPacketIndex = 0;
+    instance->traceTag = SPI_TRACE_TAG_NONE;
+    instance->lastFrameEnd = 0;
     init_crc16_tab();
 }
 
 
+/*
+*  hook - tracing hook, NULL disables tracing
+*/
+void spi_protocol_set_trace_hook(const SpiProtocolTraceHook* hook){
+    traceHook = hook;
+}
+
+
 /*
 *  instance - spi protocol instance pointer
 *  buffer - uint8_t pointer to buffer where packet bytes reside
-*  size - number of bytes to parse (max sizeof(SpiProtocolPacket))
+*  size - number of bytes to parse (max SPI_PKT_SIZE)
 *
 *  returns: SpiProtocolPacket pointer, NULL if packet wasn't parsed
 */
 SpiProtocolPacket* spi_protocol_parse(SpiProtocolInstance* instance, const uint8_t* buffer, int size){
 
-    // max bytes to parse: SPI_PROTOCOL_PAYLOAD_SIZE
-    assert(size >= 0 && size <= (int) sizeof(SpiProtocolPacket));
+    // max bytes to parse: SPI_PKT_SIZE
+    assert(size >= 0 && size <= SPI_PKT_SIZE);
 
     // Get current packet
     SpiProtocolPacket* packet = get_current_packet(instance);
@@ -156,10 +176,18 @@ SpiProtocolPacket* spi_protocol_parse(SpiProtocolInstance* instance, const uint8
                 packet->end = curByte;
 
                 // This is the end of the current packet, check if packet is okay
-                if(is_packet_ok(packet)){
+                const SpiProtocolTraceHook* hook = traceHook;
+                uint64_t start = hook ? hook->now_ns(hook->user) : 0;
+                int ok = is_packet_ok(packet);
+                if(hook != NULL){
+                    hook->validated(hook->user, instance->traceTag, ok, start, hook->now_ns(hook->user));
+                }
+
+                if(ok){
 
                     // Increment packet count
                     packetCount++;
+                    instance->lastFrameEnd = i + 1;
 
                     // Switch to other packet
                     packet = switch_current_packet(instance);
@@ -284,3 +312,63 @@ int spi_protocol_inplace_packet(SpiProtocolPacket* packet){
     return SPI_PROTOCOL_OK;
 
 }
+
+/*
+* frame - pointer to SPI_PKT_SIZE bytes as received on the wire
+* Returns: 1 frame is valid, 0 otherwise
+*/
+int spi_protocol_check_frame(const uint8_t* frame){
+
+    if(frame[0] != START_BYTE_MAGIC){
+        return 0;
+    }
+
+    const uint8_t* crcBytes = frame + 1 + SPI_PROTOCOL_PAYLOAD_SIZE;
+    uint16_t crc = (crcBytes[0] & 0xFF) | ((((uint16_t) crcBytes[1]) << 8) & 0xFF00);
+    if(crc != crc_modbus(frame + 1, SPI_PROTOCOL_PAYLOAD_SIZE)){
+        return 0;
+    }
+
+    if(frame[SPI_PKT_SIZE - 1] != END_BYTE_MAGIC){
+        return 0;
+    }
+
+    return 1;
+}
+
+/*
+* frame - pointer to SPI_PKT_SIZE bytes as received on the wire
+* packet - pointer to SpiProtocolPacket where it will be written
+*/
+void spi_protocol_frame_to_packet(const uint8_t* frame, SpiProtocolPacket* packet){
+    packet->start = frame[0];
+    memcpy(packet->data, frame + 1, SPI_PROTOCOL_PAYLOAD_SIZE);
+    packet->crc[0] = frame[1 + SPI_PROTOCOL_PAYLOAD_SIZE];
+    packet->crc[1] = frame[2 + SPI_PROTOCOL_PAYLOAD_SIZE];
+    packet->end = frame[SPI_PKT_SIZE - 1];
+}
+
+
+/*
+*  packet - packet to split
+*  segments - SPI_PROTOCOL_SEGMENTS entries: start byte, payload, crc + end byte
+*/
+void spi_protocol_packet_segments(SpiProtocolPacket* packet, SpiProtocolSegment* segments){
+    segments[0].address = &packet->start;
+    segments[0].size = 1;
+    segments[1].address = packet->data;
+    segments[1].size = SPI_PROTOCOL_PAYLOAD_SIZE;
+    // crc and end are adjacent in both layouts
+    segments[2].address = packet->crc;
+    segments[2].size = sizeof(packet->crc) + sizeof(packet->end);
+}
+
+
+/*
+*  packet - packet received in place
+*
+*  returns: 1 if valid, 0 otherwise
+*/
+int spi_protocol_check_packet(const SpiProtocolPacket* packet){
+    return is_packet_ok(packet);
+}
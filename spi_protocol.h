@@ -24,22 +24,82 @@ extern "C" {
 static const uint8_t START_BYTE_MAGIC = 0b10101010;
 static const uint8_t END_BYTE_MAGIC = 0b00000000;
 
+// Define SPI_PROTOCOL_ALIGNED_LAYOUT to keep packet data on a SPI_PROTOCOL_DATA_ALIGNMENT
+// boundary for SIMD decoders and payload DMA. The packet is then padded in front of the
+// start byte, so the frame no longer begins at the packet address, and the contiguous
+// frame (SPI_PROTOCOL_FRAME(packet), the SPI_PKT_SIZE bytes which go over the wire) sits
+// at offset ALIGNMENT - 1, misaligned for whole-frame DMA.
+//
+// DMA with either layout:
+//  - whole frame, one descriptor: default layout, packet allocated on the engine's
+//    alignment (the frame starts at the packet address, payload at +1)
+//  - payload aligned: aligned layout, three descriptors per frame from
+//    spi_protocol_packet_segments(): header (start byte), payload (aligned) and trailer
+//    (CRC + end byte, 4-byte aligned). Header and trailer are 1 and 3 bytes, engines which
+//    need every descriptor aligned have to bounce those two through aligned scratch bytes.
+//    Received packets are validated in place with spi_protocol_check_packet().
+#ifndef SPI_PROTOCOL_DATA_ALIGNMENT
+#define SPI_PROTOCOL_DATA_ALIGNMENT 64
+#endif
+
+#ifdef __cplusplus
+#define SPI_PROTOCOL_ALIGNAS(x) alignas(x)
+#else
+#define SPI_PROTOCOL_ALIGNAS(x) _Alignas(x)
+#endif
+
+#define SPI_PROTOCOL_FRAME(packet) (&(packet)->start)
+
+// Scatter-gather split of a frame, in wire order: header, payload, trailer
+#define SPI_PROTOCOL_SEGMENTS 3
+typedef struct {
+    uint8_t* address;
+    uint16_t size;
+} SpiProtocolSegment;
+
+#ifdef SPI_PROTOCOL_ALIGNED_LAYOUT
+typedef struct {
+    SPI_PROTOCOL_ALIGNAS(SPI_PROTOCOL_DATA_ALIGNMENT) uint8_t padding[SPI_PROTOCOL_DATA_ALIGNMENT - 1];
+    uint8_t start;
+    uint8_t data[SPI_PROTOCOL_PAYLOAD_SIZE];
+    uint8_t crc[2];
+    uint8_t end;
+} SpiProtocolPacket;
+#else
 typedef struct {
     uint8_t start;
     uint8_t data[SPI_PROTOCOL_PAYLOAD_SIZE];
     uint8_t crc[2];
     uint8_t end;
 } SpiProtocolPacket;
+#endif
 
 typedef struct {
     int state;
     int payloadOffset;
     int currentPacketIndex;
+    // Tag of the command whose response is being parsed, handed to the trace hook (SPI_TRACE_TAG_NONE by default)
+    int traceTag;
+    // Offset just past the end byte of the packet returned by the last spi_protocol_parse() call, within its buffer
+    int lastFrameEnd;
     // 2 packets can be decoded at a time max
     SpiProtocolPacket packet[2];
 } SpiProtocolInstance;
 
 
+// Command tag of traced phases which aren't attributed to any command
+#define SPI_TRACE_TAG_NONE (-1)
+
+// Optional tracing hook, see spi_trace.h (spi_trace_install). Called for every
+// frame spi_protocol_parse() validates, with the time spent on the CRC check
+// and the traceTag of the parsing instance.
+typedef struct {
+    uint64_t (*now_ns)(void* user);
+    void (*validated)(void* user, int tag, int ok, uint64_t start_ns, uint64_t end_ns);
+    void* user;
+} SpiProtocolTraceHook;
+
+
 enum SPI_PROTOCOL_RETURN_CODE {
     SPI_PROTOCOL_OK = 0,
     SPI_PROTOCOL_PACKET_NULL = -1,
@@ -58,7 +118,7 @@ void spi_protocol_init(SpiProtocolInstance *instance);
  *
  * @param instance Spi protocol instance pointer
  * @param buffer Pointer to buffer where packet bytes reside
- * @param size Number of bytes to parse (max SPI_PROTOCOL_PAYLOAD_SIZE)
+ * @param size Number of bytes to parse (max SPI_PKT_SIZE)
  *
  * @returns SpiProtocolPacket pointer, NULL if packet wasn't parsed
  */
@@ -85,6 +145,49 @@ int spi_protocol_write_packet2(SpiProtocolPacket* packet, const uint8_t* payload
 int spi_protocol_inplace_packet(SpiProtocolPacket* packet);
 
 
+/**
+ * Installs a tracing hook for spi_protocol_parse()
+ *
+ * @param hook Hook, NULL disables tracing. Must stay valid while installed.
+ */
+void spi_protocol_set_trace_hook(const SpiProtocolTraceHook* hook);
+
+
+/**
+ * Validates a raw frame of SPI_PKT_SIZE bytes as received on the wire (start byte, CRC, end byte)
+ *
+ * @param frame Pointer to SPI_PKT_SIZE bytes
+ * @returns 1 frame is valid, 0 otherwise
+ */
+int spi_protocol_check_frame(const uint8_t* frame);
+
+
+/**
+ * Copies a raw frame of SPI_PKT_SIZE bytes as received on the wire into a SpiProtocolPacket
+ *
+ * @param frame Pointer to SPI_PKT_SIZE bytes
+ * @param packet Pointer to SpiProtocolPacket where it will be written
+ */
+void spi_protocol_frame_to_packet(const uint8_t* frame, SpiProtocolPacket* packet);
+
+
+/**
+ * Splits a packet's frame into SPI_PROTOCOL_SEGMENTS DMA descriptors (header, payload, trailer),
+ * see SPI_PROTOCOL_ALIGNED_LAYOUT for their alignment
+ *
+ * @param packet Packet to send from or receive into
+ * @param segments Array of SPI_PROTOCOL_SEGMENTS entries to fill
+ */
+void spi_protocol_packet_segments(SpiProtocolPacket* packet, SpiProtocolSegment* segments);
+
+/**
+ * Validates a packet received in place, eg. through spi_protocol_packet_segments() descriptors
+ *
+ * @returns 1 packet is valid, 0 otherwise
+ */
+int spi_protocol_check_packet(const SpiProtocolPacket* packet);
+
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,192 @@
+/*
+ * spi_protocol_bulk.c
+ *
+ *  Multi-threaded parsing of large buffers (captures, DMA batches).
+ *
+ */
+
+#include <spi_protocol_bulk.h>
+#include <spi_protocol.h>
+
+#include <string.h>
+#include <stdlib.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SPI_PROTOCOL_BULK_HAVE_PTHREAD 1
+#include <pthread.h>
+#endif
+
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+
+typedef struct {
+    const uint8_t* buffer;
+    const size_t* offsets;
+    uint8_t* valid;
+    SpiProtocolPacket* packets;
+    int maxPackets;
+    // Range of candidate frames handled by this worker
+    int first;
+    int last;
+    // Number of valid frames in range, and output index of the first one
+    int count;
+    int outputIndex;
+} BulkWork;
+
+
+static void validate_range(BulkWork* work){
+    work->count = 0;
+    for(int i = work->first; i < work->last; i++){
+        work->valid[i] = (uint8_t) spi_protocol_check_frame(work->buffer + work->offsets[i]);
+        work->count += work->valid[i];
+    }
+}
+
+static void copy_range(BulkWork* work){
+    int out = work->outputIndex;
+    for(int i = work->first; i < work->last && out < work->maxPackets; i++){
+        if(work->valid[i]){
+            spi_protocol_frame_to_packet(work->buffer + work->offsets[i], work->packets + out);
+            out++;
+        }
+    }
+}
+
+#ifdef SPI_PROTOCOL_BULK_HAVE_PTHREAD
+static void* validate_worker(void* arg){
+    validate_range((BulkWork*) arg);
+    return NULL;
+}
+
+static void* copy_worker(void* arg){
+    copy_range((BulkWork*) arg);
+    return NULL;
+}
+
+// Runs fn over all work items, the first one on the calling thread
+static int run_parallel(BulkWork* work, int num_threads, void* (*fn)(void*)){
+    pthread_t threads[SPI_PROTOCOL_BULK_MAX_THREADS];
+    int started = 0;
+    int ret = 0;
+    for(int t = 1; t < num_threads; t++){
+        if(pthread_create(&threads[t], NULL, fn, &work[t]) != 0){
+            ret = SPI_PROTOCOL_BULK_THREAD_ERROR;
+            break;
+        }
+        started = t;
+    }
+    fn(&work[0]);
+    for(int t = 1; t <= started; t++){
+        pthread_join(threads[t], NULL);
+    }
+    return ret;
+}
+#endif
+
+
+int spi_protocol_parse_bulk(const uint8_t* buffer, size_t size, SpiProtocolPacket* packets, int max_packets, int num_threads, size_t* consumed){
+
+    // Quick scan for frame boundaries, same skipping rules as spi_protocol_parse
+    size_t maxFrames = size / SPI_PKT_SIZE + 1;
+    size_t* offsets = (size_t*) malloc(maxFrames * sizeof(size_t));
+    uint8_t* valid = (uint8_t*) malloc(maxFrames);
+    if(offsets == NULL || valid == NULL){
+        free(offsets);
+        free(valid);
+        return SPI_PROTOCOL_BULK_NO_MEMORY;
+    }
+
+    int numFrames = 0;
+    size_t pos = 0;
+    while(pos < size){
+        const uint8_t* start = (const uint8_t*) memchr(buffer + pos, START_BYTE_MAGIC, size - pos);
+        if(start == NULL){
+            pos = size;
+            break;
+        }
+        pos = (size_t) (start - buffer);
+        if(size - pos < SPI_PKT_SIZE){
+            // Partial frame at the end, leave it unconsumed
+            break;
+        }
+        offsets[numFrames++] = pos;
+        pos += SPI_PKT_SIZE;
+    }
+
+    if(num_threads < 1){
+        num_threads = 1;
+    }
+    num_threads = MIN(num_threads, SPI_PROTOCOL_BULK_MAX_THREADS);
+    // Not worth spawning threads for a handful of frames
+    num_threads = MIN(num_threads, numFrames / 64 + 1);
+#ifndef SPI_PROTOCOL_BULK_HAVE_PTHREAD
+    num_threads = 1;
+#endif
+
+    BulkWork work[SPI_PROTOCOL_BULK_MAX_THREADS];
+    for(int t = 0; t < num_threads; t++){
+        work[t].buffer = buffer;
+        work[t].offsets = offsets;
+        work[t].valid = valid;
+        work[t].packets = packets;
+        work[t].maxPackets = max_packets;
+        work[t].first = (int) (((long long) numFrames * t) / num_threads);
+        work[t].last = (int) (((long long) numFrames * (t + 1)) / num_threads);
+    }
+
+    int ret = 0;
+
+    // Pass 1: validate CRCs
+#ifdef SPI_PROTOCOL_BULK_HAVE_PTHREAD
+    ret = run_parallel(work, num_threads, validate_worker);
+#else
+    validate_range(&work[0]);
+#endif
+
+    // Output position of each worker's first valid frame keeps the order
+    int total = 0;
+    for(int t = 0; t < num_threads && ret == 0; t++){
+        work[t].outputIndex = total;
+        total += work[t].count;
+    }
+
+    // Pass 2: copy valid frames into place
+    if(ret == 0){
+#ifdef SPI_PROTOCOL_BULK_HAVE_PTHREAD
+        ret = run_parallel(work, num_threads, copy_worker);
+#else
+        copy_range(&work[0]);
+#endif
+    }
+
+    if(ret == 0 && total > max_packets){
+        // Output is full, report consumption up to the end of the last emitted frame,
+        // or up to the first valid frame if none could be emitted
+        if(max_packets < 0){
+            max_packets = 0;
+        }
+        int emitted = 0;
+        for(int i = 0; i < numFrames; i++){
+            if(!valid[i]){
+                continue;
+            }
+            if(emitted == max_packets){
+                pos = offsets[i];
+                break;
+            }
+            if(++emitted == max_packets){
+                pos = offsets[i] + SPI_PKT_SIZE;
+                break;
+            }
+        }
+        total = max_packets;
+    }
+
+    if(consumed != NULL){
+        *consumed = pos;
+    }
+
+    free(offsets);
+    free(valid);
+
+    return ret == 0 ? total : ret;
+}
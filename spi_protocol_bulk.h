@@ -0,0 +1,56 @@
+/*
+ * spi_protocol_bulk.h
+ *
+ *  Multi-threaded parsing of large buffers (captures, DMA batches).
+ *
+ *  Framing is identical to feeding the buffer through spi_protocol_parse()
+ *  from a freshly initialized instance: the parser skips to the next start
+ *  byte and always consumes a whole frame, valid or not. Frame boundaries
+ *  therefore only depend on start byte positions and are located with a
+ *  quick sequential scan, after which CRC validation and payload copies run
+ *  on a pool of worker threads. Output order is preserved.
+ *
+ */
+
+#ifndef SHARED_SPI_PROTOCOL_BULK_H
+#define SHARED_SPI_PROTOCOL_BULK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <spi_protocol.h>
+
+#define SPI_PROTOCOL_BULK_MAX_THREADS 64
+
+enum SPI_PROTOCOL_BULK_RETURN_CODE {
+    SPI_PROTOCOL_BULK_NO_MEMORY = -1,
+    SPI_PROTOCOL_BULK_THREAD_ERROR = -2
+};
+
+
+/**
+ * Parses all complete frames in a buffer
+ *
+ * @param buffer Input bytes
+ * @param size Number of input bytes
+ * @param packets Output array, valid packets in input order
+ * @param max_packets Capacity of packets
+ * @param num_threads Number of worker threads, 1 validates on the calling thread
+ * @param consumed Optional, number of input bytes processed. Remaining bytes
+ *                 (a trailing partial frame) can be passed on to spi_protocol_parse().
+ *                 If packets is full, ends after the last packet returned (before the
+ *                 first valid frame if none fit), so the rest can be parsed again.
+ * @returns number of valid packets, -1 allocation failed, -2 threads couldn't be started
+ */
+int spi_protocol_parse_bulk(const uint8_t* buffer, size_t size, SpiProtocolPacket* packets, int max_packets, int num_threads, size_t* consumed);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
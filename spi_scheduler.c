@@ -0,0 +1,206 @@
+/*
+ * spi_scheduler.c
+ *
+ *  Host side per-stream priority scheduling of outgoing commands.
+ *
+ */
+
+#include <spi_scheduler.h>
+#include <spi_messaging.h>
+#include <spi_trace.h>
+#include <spi_protocol.h>
+
+#include <string.h>
+
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+
+#define REQUEST_FREE    (0)
+#define REQUEST_QUEUED  (1) // commands left to issue
+#define REQUEST_ISSUED  (2) // all commands issued, waiting for spi_scheduler_complete
+
+
+static int is_class_queued(const SpiScheduler* scheduler, int priority){
+    for(int i = 0; i < SPI_SCHED_MAX_REQUESTS; i++){
+        const SpiSchedRequest* request = &scheduler->requests[i];
+        if(request->state == REQUEST_QUEUED && scheduler->streams[request->stream].priority == priority){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Oldest queued request of a stream, NULL if none
+static SpiSchedRequest* get_stream_request(SpiScheduler* scheduler, int stream){
+    SpiSchedRequest* oldest = NULL;
+    for(int i = 0; i < SPI_SCHED_MAX_REQUESTS; i++){
+        SpiSchedRequest* request = &scheduler->requests[i];
+        if(request->state == REQUEST_QUEUED && request->stream == stream){
+            if(oldest == NULL || (int32_t) (request->id - oldest->id) < 0){
+                oldest = request;
+            }
+        }
+    }
+    return oldest;
+}
+
+static int pick_class(SpiScheduler* scheduler){
+    int queued[SPI_PRIORITY_CLASSES];
+    int picked = -1;
+    for(int c = 0; c < SPI_PRIORITY_CLASSES; c++){
+        queued[c] = is_class_queued(scheduler, c);
+        if(queued[c] && picked < 0){
+            picked = c;
+        }
+    }
+    if(picked < 0){
+        return -1;
+    }
+
+    // A lower class that waited long enough takes the slot, longest waiting (then lowest) class first
+    int overdue = -1;
+    for(int c = picked + 1; c < SPI_PRIORITY_CLASSES; c++){
+        if(queued[c] && scheduler->starved[c] >= SPI_SCHED_STARVATION_LIMIT && (overdue < 0 || scheduler->starved[c] >= scheduler->starved[overdue])){
+            overdue = c;
+        }
+    }
+    if(overdue >= 0){
+        picked = overdue;
+    }
+
+    for(int c = 0; c < SPI_PRIORITY_CLASSES; c++){
+        if(c == picked || !queued[c]){
+            scheduler->starved[c] = 0;
+        } else {
+            scheduler->starved[c]++;
+        }
+    }
+    return picked;
+}
+
+// Weighted round robin between streams of a class
+static SpiSchedRequest* pick_request(SpiScheduler* scheduler, int priority){
+    int current = scheduler->cursor[priority];
+    if(current < scheduler->numStreams && scheduler->streams[current].priority == priority && scheduler->burst[priority] < scheduler->streams[current].weight){
+        SpiSchedRequest* request = get_stream_request(scheduler, current);
+        if(request != NULL){
+            scheduler->burst[priority]++;
+            return request;
+        }
+    }
+
+    for(int i = 1; i <= scheduler->numStreams; i++){
+        int stream = (current + i) % scheduler->numStreams;
+        if(scheduler->streams[stream].priority != priority){
+            continue;
+        }
+        SpiSchedRequest* request = get_stream_request(scheduler, stream);
+        if(request != NULL){
+            scheduler->cursor[priority] = stream;
+            scheduler->burst[priority] = 1;
+            return request;
+        }
+    }
+
+    return NULL;
+}
+
+
+void spi_scheduler_init(SpiScheduler* scheduler){
+    memset(scheduler, 0, sizeof(*scheduler));
+}
+
+int spi_scheduler_add_stream(SpiScheduler* scheduler, const char* stream_name, uint8_t stream_name_len, spi_priority priority, uint8_t weight){
+    if(scheduler->numStreams >= MAX_STREAMS){
+        return SPI_SCHED_FULL;
+    }
+    if(priority >= SPI_PRIORITY_CLASSES || stream_name_len > MAX_STREAMNAME){
+        return SPI_SCHED_INVALID;
+    }
+
+    SpiStreamQos* qos = &scheduler->streams[scheduler->numStreams];
+    memcpy(qos->stream_name, stream_name, stream_name_len);
+    qos->stream_name_len = stream_name_len;
+    qos->priority = priority;
+    qos->weight = weight > 0 ? weight : 1;
+
+    return scheduler->numStreams++;
+}
+
+int spi_scheduler_submit(SpiScheduler* scheduler, int stream, spi_command cmd, uint32_t offset, uint32_t size, uint32_t chunk_size, uint32_t metadata_size, uint32_t send_data_size, uint64_t now_ns){
+    if(stream < 0 || stream >= scheduler->numStreams){
+        return SPI_SCHED_INVALID;
+    }
+    if(cmd == GET_MESSAGE_PART && (size == 0 || chunk_size == 0)){
+        return SPI_SCHED_INVALID;
+    }
+
+    for(int i = 0; i < SPI_SCHED_MAX_REQUESTS; i++){
+        SpiSchedRequest* request = &scheduler->requests[i];
+        if(request->state == REQUEST_FREE){
+            request->state = REQUEST_QUEUED;
+            request->stream = (uint8_t) stream;
+            request->cmd = cmd;
+            request->id = scheduler->nextId++ & 0x7FFFFFFF;
+            request->offset = offset;
+            request->size = size;
+            request->chunk_size = chunk_size;
+            request->metadata_size = metadata_size;
+            request->send_data_size = send_data_size;
+            request->enqueue_ns = now_ns;
+            return (int) request->id;
+        }
+    }
+
+    return SPI_SCHED_FULL;
+}
+
+int spi_scheduler_next(SpiScheduler* scheduler, SpiProtocolPacket* packet, SpiSchedRequest* issued){
+    int priority = pick_class(scheduler);
+    if(priority < 0){
+        return 0;
+    }
+
+    SpiSchedRequest* request = pick_request(scheduler, priority);
+    if(request == NULL){
+        return 0;
+    }
+    const SpiStreamQos* qos = &scheduler->streams[request->stream];
+
+    if(issued != NULL){
+        *issued = *request;
+    }
+
+    if(request->cmd == GET_MESSAGE_PART){
+        uint32_t partSize = MIN(request->chunk_size, request->size);
+        spi_generate_command_partial(packet, request->cmd, qos->stream_name_len, qos->stream_name, request->offset, partSize);
+        if(issued != NULL){
+            issued->size = partSize;
+        }
+        request->offset += partSize;
+        request->size -= partSize;
+        if(request->size == 0){
+            request->state = REQUEST_ISSUED;
+        }
+    } else if(request->cmd == SEND_DATA){
+        spi_generate_command_send(packet, request->cmd, qos->stream_name_len, qos->stream_name, request->metadata_size, request->send_data_size);
+        request->state = REQUEST_ISSUED;
+    } else {
+        spi_generate_command(packet, request->cmd, qos->stream_name_len, qos->stream_name);
+        request->state = REQUEST_ISSUED;
+    }
+
+    return 1;
+}
+
+int spi_scheduler_complete(SpiScheduler* scheduler, uint32_t id, uint64_t now_ns){
+    for(int i = 0; i < SPI_SCHED_MAX_REQUESTS; i++){
+        SpiSchedRequest* request = &scheduler->requests[i];
+        if(request->state == REQUEST_ISSUED && request->id == id){
+            uint64_t latency = now_ns > request->enqueue_ns ? now_ns - request->enqueue_ns : 0;
+            spi_trace_histogram_record(&scheduler->latency[scheduler->streams[request->stream].priority], latency);
+            request->state = REQUEST_FREE;
+            return SPI_SCHED_OK;
+        }
+    }
+    return SPI_SCHED_INVALID;
+}
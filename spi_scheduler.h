@@ -0,0 +1,123 @@
+/*
+ * spi_scheduler.h
+ *
+ *  Host side per-stream priority scheduling of outgoing commands.
+ *
+ *  Bulk reads are split into GET_MESSAGE_PART commands of chunk_size bytes,
+ *  so a higher priority command never waits for more than one chunk. With
+ *  chunk_size == SPI_PROTOCOL_PAYLOAD_SIZE interleaving is per packet.
+ *
+ */
+
+#ifndef SHARED_SPI_SCHEDULER_H
+#define SHARED_SPI_SCHEDULER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <spi_protocol.h>
+#include <spi_messaging.h>
+#include <spi_trace.h>
+
+#define SPI_SCHED_MAX_REQUESTS 16
+// A class with queued work gets the next slot once this many commands went to other classes.
+// Counted per class, so every class is served at least once per LIMIT + SPI_PRIORITY_CLASSES commands.
+#define SPI_SCHED_STARVATION_LIMIT 16
+
+typedef enum {
+    SPI_PRIORITY_HIGH = 0,
+    SPI_PRIORITY_NORMAL,
+    SPI_PRIORITY_BULK,
+    SPI_PRIORITY_CLASSES
+} spi_priority;
+
+enum SPI_SCHED_RETURN_CODE {
+    SPI_SCHED_OK = 0,
+    SPI_SCHED_FULL = -1,
+    SPI_SCHED_INVALID = -2
+};
+
+typedef struct {
+    char stream_name[MAX_STREAMNAME];
+    uint8_t stream_name_len;
+    uint8_t priority;
+    // consecutive commands a stream may issue before the next stream of its class is served
+    uint8_t weight;
+} SpiStreamQos;
+
+typedef struct {
+    uint8_t state;
+    uint8_t stream;
+    spi_command cmd;
+    uint32_t id;
+    uint32_t offset;
+    uint32_t size;
+    uint32_t chunk_size;
+    uint32_t metadata_size;
+    uint32_t send_data_size;
+    uint64_t enqueue_ns;
+} SpiSchedRequest;
+
+typedef struct {
+    SpiStreamQos streams[MAX_STREAMS];
+    int numStreams;
+    SpiSchedRequest requests[SPI_SCHED_MAX_REQUESTS];
+    uint32_t nextId;
+    int cursor[SPI_PRIORITY_CLASSES];
+    int burst[SPI_PRIORITY_CLASSES];
+    // commands issued to other classes while this class had queued work
+    int starved[SPI_PRIORITY_CLASSES];
+    // Queue to completion latency per class, read with spi_trace_percentile()
+    SpiLatencyHistogram latency[SPI_PRIORITY_CLASSES];
+} SpiScheduler;
+
+
+void spi_scheduler_init(SpiScheduler* scheduler);
+
+/**
+ * Registers a stream with its QoS class
+ *
+ * @returns stream index, -1 no room, -2 invalid priority or name
+ */
+int spi_scheduler_add_stream(SpiScheduler* scheduler, const char* stream_name, uint8_t stream_name_len, spi_priority priority, uint8_t weight);
+
+/**
+ * Queues a command for a stream
+ *
+ * @param stream Stream index returned by spi_scheduler_add_stream()
+ * @param cmd Command to send, GET_MESSAGE_PART is split into chunks
+ * @param offset Start offset (GET_MESSAGE_PART)
+ * @param size Total size to read (GET_MESSAGE_PART)
+ * @param chunk_size Bytes per GET_MESSAGE_PART command
+ * @param metadata_size Announced metadata size (SEND_DATA)
+ * @param send_data_size Announced data size (SEND_DATA)
+ * @param now_ns Current time, used for latency statistics
+ * @returns request id (>= 0), -1 queue full, -2 invalid stream
+ */
+int spi_scheduler_submit(SpiScheduler* scheduler, int stream, spi_command cmd, uint32_t offset, uint32_t size, uint32_t chunk_size, uint32_t metadata_size, uint32_t send_data_size, uint64_t now_ns);
+
+/**
+ * Generates the next command to send according to stream priorities
+ *
+ * @param packet Where the command packet is written
+ * @param issued Optional, filled with request id, offset and size of the issued command
+ * @returns 1 if a command was generated, 0 if nothing is queued
+ */
+int spi_scheduler_next(SpiScheduler* scheduler, SpiProtocolPacket* packet, SpiSchedRequest* issued);
+
+/**
+ * Marks a request as fully answered and records its latency in its class
+ *
+ * @returns 0 OK, -2 unknown or still pending request
+ */
+int spi_scheduler_complete(SpiScheduler* scheduler, uint32_t id, uint64_t now_ns);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
@@ -0,0 +1,232 @@
+/*
+ * spi_trace.c
+ *
+ *  Optional latency instrumentation for spi_messaging.
+ *
+ */
+
+#include <spi_trace.h>
+#include <spi_messaging.h>
+#include <spi_protocol.h>
+
+#include <string.h>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define ATOMIC_ADD_32(ptr, val) __atomic_fetch_add((ptr), (val), __ATOMIC_RELAXED)
+#define ATOMIC_LOAD_64(ptr) __atomic_load_n((ptr), __ATOMIC_RELAXED)
+#define ATOMIC_CAS_64(ptr, expected, desired) __atomic_compare_exchange_n((ptr), (expected), (desired), 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+#else
+// Single threaded fallback
+#define ATOMIC_ADD_32(ptr, val) ((*(ptr) += (val)) - (val))
+#define ATOMIC_LOAD_64(ptr) (*(ptr))
+#define ATOMIC_CAS_64(ptr, expected, desired) ((*(ptr) == *(expected)) ? (*(ptr) = (desired), 1) : (*(expected) = *(ptr), 0))
+#endif
+
+static const char* PHASE_NAMES[SPI_TRACE_PHASES] = {"encode", "turnaround", "transfer", "crc", "reassembly"};
+
+
+static int get_magnitude(uint64_t value){
+    int msb = 0;
+    while(value >>= 1){
+        msb++;
+    }
+    return msb;
+}
+
+static int get_bucket(uint64_t value){
+    if(value < (2u << SPI_TRACE_SUB_BUCKET_BITS)){
+        return (int) value;
+    }
+    int msb = get_magnitude(value);
+    if(msb > SPI_TRACE_MAX_MAGNITUDE){
+        return SPI_TRACE_BUCKETS - 1;
+    }
+    int shift = msb - SPI_TRACE_SUB_BUCKET_BITS;
+    return (shift << SPI_TRACE_SUB_BUCKET_BITS) + (int) (value >> shift);
+}
+
+static uint64_t get_bucket_upper(int bucket){
+    if(bucket < (2 << SPI_TRACE_SUB_BUCKET_BITS)){
+        return (uint64_t) bucket;
+    }
+    int shift = (bucket >> SPI_TRACE_SUB_BUCKET_BITS) - 1;
+    uint64_t sub = (uint64_t) ((bucket & ((1 << SPI_TRACE_SUB_BUCKET_BITS) - 1)) + (1 << SPI_TRACE_SUB_BUCKET_BITS));
+    return ((sub + 1) << shift) - 1;
+}
+
+void spi_trace_histogram_record(SpiLatencyHistogram* histogram, uint64_t value){
+    ATOMIC_ADD_32(&histogram->buckets[get_bucket(value)], 1);
+    ATOMIC_ADD_32(&histogram->count, 1);
+
+    uint64_t max = ATOMIC_LOAD_64(&histogram->max_ns);
+    while(value > max && !ATOMIC_CAS_64(&histogram->max_ns, &max, value)){
+    }
+}
+
+
+void spi_trace_init(SpiTracer* tracer, uint64_t (*now_ns)(void), SpiTraceEvent* events, uint32_t event_capacity){
+    memset(tracer, 0, sizeof(*tracer));
+    tracer->now_ns = now_ns;
+    // Ring index is masked, capacity has to be a power of 2
+    if(events != NULL && event_capacity > 0 && (event_capacity & (event_capacity - 1)) == 0){
+        tracer->events = events;
+        tracer->eventCapacity = event_capacity;
+    }
+}
+
+int spi_trace_add_stream(SpiTracer* tracer, const char* stream_name, uint8_t stream_name_len){
+    if(tracer->numStreams >= MAX_STREAMS || stream_name_len > MAX_STREAMNAME){
+        return -1;
+    }
+    memcpy(tracer->stream_names[tracer->numStreams], stream_name, stream_name_len);
+    tracer->stream_name_lens[tracer->numStreams] = stream_name_len;
+    return tracer->numStreams++;
+}
+
+int spi_trace_find_stream(const SpiTracer* tracer, const char* stream_name, uint8_t stream_name_len){
+    for(int i = 0; i < tracer->numStreams; i++){
+        if(tracer->stream_name_lens[i] == stream_name_len && memcmp(tracer->stream_names[i], stream_name, stream_name_len) == 0){
+            return i;
+        }
+    }
+    return -1;
+}
+
+void spi_trace_record(SpiTracer* tracer, spi_command cmd, int stream, spi_trace_phase phase, uint64_t start_ns, uint64_t end_ns){
+    if(phase >= SPI_TRACE_PHASES){
+        return;
+    }
+    uint64_t duration = end_ns > start_ns ? end_ns - start_ns : 0;
+
+    if((unsigned) cmd < SPI_TRACE_MAX_COMMANDS){
+        spi_trace_histogram_record(&tracer->commands[cmd][phase], duration);
+    }
+    if(stream >= 0 && stream < tracer->numStreams){
+        spi_trace_histogram_record(&tracer->streams[stream][phase], duration);
+    }
+
+    if(tracer->events != NULL){
+        uint32_t index = ATOMIC_ADD_32(&tracer->eventHead, 1) & (tracer->eventCapacity - 1);
+        SpiTraceEvent* event = &tracer->events[index];
+        event->start_ns = start_ns;
+        event->duration_ns = duration;
+        event->cmd = (uint8_t) cmd;
+        event->stream = (int8_t) (stream >= 0 && stream < tracer->numStreams ? stream : -1);
+        event->phase = (uint8_t) phase;
+    }
+}
+
+uint64_t spi_trace_percentile(const SpiLatencyHistogram* histogram, double percentile){
+    if(histogram->count == 0){
+        return 0;
+    }
+    uint64_t target = (uint64_t) ((percentile / 100.0) * histogram->count + 0.5);
+    if(target == 0){
+        target = 1;
+    }
+    uint64_t seen = 0;
+    for(int i = 0; i < SPI_TRACE_BUCKETS; i++){
+        seen += histogram->buckets[i];
+        if(seen >= target){
+            uint64_t upper = get_bucket_upper(i);
+            return upper < histogram->max_ns ? upper : histogram->max_ns;
+        }
+    }
+    return histogram->max_ns;
+}
+
+int spi_trace_write_chrome_json(const SpiTracer* tracer, FILE* file){
+    int ok = fprintf(file, "{\"traceEvents\":[") >= 0;
+
+    // Thread names, one track per stream, commands without a stream on track 0
+    ok = ok && fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"(no stream)\"}}") >= 0;
+    for(int i = 0; i < tracer->numStreams; i++){
+        ok = ok && fprintf(file, ",{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%.*s\"}}",
+            i + 1, tracer->stream_name_lens[i], tracer->stream_names[i]) >= 0;
+    }
+
+    if(tracer->events != NULL){
+        uint32_t head = tracer->eventHead;
+        uint32_t count = head < tracer->eventCapacity ? head : tracer->eventCapacity;
+        for(uint32_t n = 0; n < count; n++){
+            const SpiTraceEvent* event = &tracer->events[(head - count + n) & (tracer->eventCapacity - 1)];
+            // Chrome trace timestamps are in microseconds
+            ok = ok && fprintf(file, ",{\"name\":\"%s\",\"cat\":\"cmd%u\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"cmd\":%u}}",
+                event->phase < SPI_TRACE_PHASES ? PHASE_NAMES[event->phase] : "unknown",
+                event->cmd, event->stream + 1, event->start_ns / 1000.0, event->duration_ns / 1000.0, event->cmd) >= 0;
+        }
+    }
+
+    ok = ok && fprintf(file, "],\"displayTimeUnit\":\"ns\"}\n") >= 0;
+    return ok ? 0 : -1;
+}
+
+// Tag layout: command in the low byte, stream index + 1 above it (0 - no stream)
+int spi_trace_tag(const SpiTracer* tracer, spi_command cmd, int stream){
+    if((unsigned) cmd >= SPI_TRACE_MAX_COMMANDS){
+        return SPI_TRACE_TAG_NONE;
+    }
+    if(stream < 0 || stream >= tracer->numStreams){
+        stream = -1;
+    }
+    return (int) cmd | ((stream + 1) << 8);
+}
+
+void spi_trace_record_tag(SpiTracer* tracer, int tag, spi_trace_phase phase, uint64_t start_ns, uint64_t end_ns){
+    if(tag < 0){
+        spi_trace_record(tracer, (spi_command) SPI_TRACE_MAX_COMMANDS, -1, phase, start_ns, end_ns);
+        return;
+    }
+    spi_trace_record(tracer, (spi_command) (tag & 0xFF), (tag >> 8) - 1, phase, start_ns, end_ns);
+}
+
+
+// Hooks installed into spi_messaging and spi_protocol
+
+static SpiMessagingTraceHook messagingHook;
+static SpiProtocolTraceHook protocolHook;
+
+static uint64_t hook_now(void* user){
+    return ((SpiTracer*) user)->now_ns();
+}
+
+static void hook_encoded(void* user, spi_command command, uint8_t stream_name_len, const char* stream_name, uint64_t start_ns, uint64_t end_ns){
+    SpiTracer* tracer = (SpiTracer*) user;
+    int stream = spi_trace_find_stream(tracer, stream_name, stream_name_len);
+    spi_trace_record(tracer, command, stream, SPI_TRACE_ENCODE, start_ns, end_ns);
+}
+
+static int hook_tag(void* user, spi_command command, uint8_t stream_name_len, const char* stream_name){
+    const SpiTracer* tracer = (const SpiTracer*) user;
+    return spi_trace_tag(tracer, command, spi_trace_find_stream(tracer, stream_name, stream_name_len));
+}
+
+static void hook_phase(void* user, int tag, int phase, uint64_t start_ns, uint64_t end_ns){
+    spi_trace_record_tag((SpiTracer*) user, tag, (spi_trace_phase) phase, start_ns, end_ns);
+}
+
+static void hook_validated(void* user, int tag, int ok, uint64_t start_ns, uint64_t end_ns){
+    (void) ok;
+    spi_trace_record_tag((SpiTracer*) user, tag, SPI_TRACE_CRC, start_ns, end_ns);
+}
+
+void spi_trace_install(SpiTracer* tracer){
+    if(tracer == NULL){
+        spi_messaging_set_trace_hook(NULL);
+        spi_protocol_set_trace_hook(NULL);
+        return;
+    }
+
+    messagingHook.now_ns = hook_now;
+    messagingHook.encoded = hook_encoded;
+    messagingHook.tag = hook_tag;
+    messagingHook.phase = hook_phase;
+    messagingHook.user = tracer;
+
+    protocolHook.now_ns = hook_now;
+    protocolHook.validated = hook_validated;
+    protocolHook.user = tracer;
+
+    spi_messaging_set_trace_hook(&messagingHook);
+    spi_protocol_set_trace_hook(&protocolHook);
+}
@@ -0,0 +1,164 @@
+/*
+ * spi_trace.h
+ *
+ *  Optional latency instrumentation for spi_messaging: per command and per
+ *  stream log-linear (HDR style) histograms and a Chrome trace / Perfetto
+ *  JSON timeline.
+ *
+ *  Recording is lock-free (atomic increments) and keeps no "current command"
+ *  state, so transfer and parsing threads can record concurrently. Setup
+ *  (init, add_stream, install) is not.
+ *
+ *  Phases after encoding are attributed through a tag, which the caller gets
+ *  once per command and carries along with the response:
+ *
+ *      int tag = spi_messaging_trace_tag(GET_MESSAGE_PART, len, "color");
+ *      parser.traceTag = tag;              // SpiProtocolInstance parsing the response
+ *      spi::Message message(size, tag);    // C++ layer
+ *
+ *  Pipelined commands (eg. spi_scheduler) are attributed correctly as long
+ *  as each response is parsed with its command's tag set, eg. one instance
+ *  per outstanding command or retagging before each response's frames.
+ *
+ *  Once installed (spi_trace_install), the library records by itself:
+ *      ENCODE      - every spi_generate_command* call
+ *      CRC         - every frame validated by spi_protocol_parse(), instance tag
+ *      REASSEMBLY  - spi::Message::append of the C++ layer, message tag
+ *  Phases which happen in the host's transfer code are recorded by the caller:
+ *
+ *      uint64_t start = spi_messaging_trace_now();
+ *      ... SPI transfer of the command / response packets ...
+ *      spi_messaging_trace_phase(tag, SPI_TRACE_TRANSFER, start);
+ *
+ *  (SPI_TRACE_TURNAROUND likewise, from command sent to response ready)
+ *  or with spi_trace_record() when command and stream should be explicit.
+ *
+ */
+
+#ifndef SHARED_SPI_TRACE_H
+#define SHARED_SPI_TRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <spi_messaging.h>
+
+#define SPI_TRACE_MAX_COMMANDS 16
+// 8 linear sub-buckets per power of two, values up to 2^36 ns (~68s)
+#define SPI_TRACE_SUB_BUCKET_BITS 3
+#define SPI_TRACE_MAX_MAGNITUDE 36
+#define SPI_TRACE_BUCKETS (((SPI_TRACE_MAX_MAGNITUDE - SPI_TRACE_SUB_BUCKET_BITS) + 2) << SPI_TRACE_SUB_BUCKET_BITS)
+
+typedef enum {
+    SPI_TRACE_ENCODE = 0,       // command generation
+    SPI_TRACE_TURNAROUND,       // command sent until device has response ready
+    SPI_TRACE_TRANSFER,         // SPI transfer of response packets
+    SPI_TRACE_CRC,              // packet parsing / CRC validation
+    SPI_TRACE_REASSEMBLY,       // assembling message from packets
+    SPI_TRACE_PHASES
+} spi_trace_phase;
+
+typedef struct {
+    uint32_t count;
+    uint64_t max_ns;
+    uint32_t buckets[SPI_TRACE_BUCKETS];
+} SpiLatencyHistogram;
+
+typedef struct {
+    uint64_t start_ns;
+    uint64_t duration_ns;
+    uint8_t cmd;
+    int8_t stream;
+    uint8_t phase;
+} SpiTraceEvent;
+
+typedef struct {
+    uint64_t (*now_ns)(void);
+
+    char stream_names[MAX_STREAMS][MAX_STREAMNAME];
+    uint8_t stream_name_lens[MAX_STREAMS];
+    int numStreams;
+
+    SpiLatencyHistogram commands[SPI_TRACE_MAX_COMMANDS][SPI_TRACE_PHASES];
+    SpiLatencyHistogram streams[MAX_STREAMS][SPI_TRACE_PHASES];
+
+    // Event ring for timeline export, oldest events are overwritten
+    SpiTraceEvent* events;
+    uint32_t eventCapacity;
+    uint32_t eventHead;
+} SpiTracer;
+
+
+/**
+ * Initializes a tracer
+ *
+ * @param tracer Tracer to initialize (large, allocate statically or on heap)
+ * @param now_ns Monotonic clock in nanoseconds
+ * @param events Event ring buffer, NULL to only keep histograms
+ * @param event_capacity Number of events in ring, must be a power of 2
+ */
+void spi_trace_init(SpiTracer* tracer, uint64_t (*now_ns)(void), SpiTraceEvent* events, uint32_t event_capacity);
+
+/**
+ * Registers a stream name, so records by name land in per-stream histograms
+ *
+ * @returns stream index, -1 if MAX_STREAMS are registered already
+ */
+int spi_trace_add_stream(SpiTracer* tracer, const char* stream_name, uint8_t stream_name_len);
+
+/**
+ * @returns stream index of a registered name, -1 otherwise
+ */
+int spi_trace_find_stream(const SpiTracer* tracer, const char* stream_name, uint8_t stream_name_len);
+
+/**
+ * Records one phase of a command
+ *
+ * @param stream Stream index, -1 if not applicable
+ */
+void spi_trace_record(SpiTracer* tracer, spi_command cmd, int stream, spi_trace_phase phase, uint64_t start_ns, uint64_t end_ns);
+
+/**
+ * @returns upper bound (ns) of the bucket containing the given percentile (0-100)
+ */
+uint64_t spi_trace_percentile(const SpiLatencyHistogram* histogram, double percentile);
+
+/**
+ * Writes the event ring as Chrome trace JSON (chrome://tracing, ui.perfetto.dev)
+ *
+ * @returns 0 OK, -1 write failed
+ */
+int spi_trace_write_chrome_json(const SpiTracer* tracer, FILE* file);
+
+/**
+ * @param stream Stream index, -1 if not applicable
+ * @returns tag for spi_trace_record_tag() (what spi_messaging_trace_tag() returns once installed)
+ */
+int spi_trace_tag(const SpiTracer* tracer, spi_command cmd, int stream);
+
+/**
+ * Records one phase of the command identified by tag, SPI_TRACE_TAG_NONE only adds a timeline event
+ */
+void spi_trace_record_tag(SpiTracer* tracer, int tag, spi_trace_phase phase, uint64_t start_ns, uint64_t end_ns);
+
+/**
+ * Adds a single value to a histogram (lock-free)
+ */
+void spi_trace_histogram_record(SpiLatencyHistogram* histogram, uint64_t value_ns);
+
+/**
+ * Installs the tracer into spi_messaging and spi_protocol, NULL uninstalls.
+ * Only one tracer can be installed at a time.
+ */
+void spi_trace_install(SpiTracer* tracer);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif